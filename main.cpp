@@ -14,372 +14,5174 @@
 #include <curl/curl.h>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <fstream>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <chrono>
 #include <thread>
 #include <condition_variable>
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <random>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cassert>
+#include <climits>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
-//declare a global queue that contains next person to handle, elevators, and assigned elevators
-deque <deque <string>> people;
-deque <deque <string>> elevators;
-deque <string> assignedElevator;
+// every C++ heap allocation in the process goes through here, so --alloc-stats can show that the steady
+// state pipeline does not allocate. it costs an atomic increment per allocation, so it is only compiled in
+// when ALLOC_STATS is defined (cmake -DALLOC_STATS=ON). every form of new and delete is replaced, so each
+// pointer is always released by the function that matches the one that allocated it. they are kept out of
+// line, or gcc sees malloc on one side of an inlined pair and free on the other and warns about a mismatch
+atomic<long long> allocationCount{0};
 
-mutex mtx;
-condition_variable cv_scheduler; // condition variable for scheduler thread
-condition_variable cv_addToElevator; // condition varable for the reader
-bool endOfInput = false;  // initialize the end of input to false
-bool everyoneAssignedElevator = false;
-
-// Callback function to handle the response
-size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *output) {
-    size_t totalSize = size * nmemb;
-    output->append((char*)contents, totalSize);
-    return totalSize;
-}
-
-bool sortByRemainingCapacity(deque <string>& a, deque <string>& b) {
-    int aInt = stoi(a[4]);
-    int bInt = stoi(b[4]);
-    return aInt > bInt; // Sort in descending order of remaining capacity
+#ifdef ALLOC_STATS
+void* counted_alloc(size_t size, size_t alignment) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    size = size ? size : 1;
+    if (alignment <= alignof(max_align_t)) {
+        return malloc(size);
+    }
+    // aligned_alloc wants a size that is a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
 }
 
-void init_put(string url) {
-    // Initialize libcurl
-    curl_global_init(CURL_GLOBAL_ALL);
-    // Create a curl handle
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-//        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
-        // Perform the PUT request
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
-        }
-        // Cleanup the curl handle
-        curl_easy_cleanup(curl);
+void* checked_alloc(size_t size, size_t alignment) {
+    void* memory = counted_alloc(size, alignment);
+    if (memory == nullptr) {
+        throw bad_alloc();
     }
-    curl_global_cleanup();
+    return memory;
 }
 
-//init_get only needs a url to get the value in /initialize and /modify
-//it return an integer.
-string init_get(string url) {
-    // Initialize libcurl
-    curl_global_init(CURL_GLOBAL_ALL);
-    std:: string returnInt;
-    std::string buffer;
-    // Create a new curl handle for the GET request
-    // Create a curl handle
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        // Set the URL for the GET request
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
-        // Perform the GET request
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
-        }
-        // Cleanup the curl handle
-        curl_easy_cleanup(curl);
-    }
-    // Cleanup libcurl
-    curl_global_cleanup();
-    // return the value in buffer as int
-    return buffer;
+__attribute__((noinline)) void* operator new(size_t size) { return checked_alloc(size, 0); }
+__attribute__((noinline)) void* operator new[](size_t size) { return checked_alloc(size, 0); }
+__attribute__((noinline)) void* operator new(size_t size, align_val_t alignment) { return checked_alloc(size, (size_t)alignment); }
+__attribute__((noinline)) void* operator new[](size_t size, align_val_t alignment) { return checked_alloc(size, (size_t)alignment); }
+__attribute__((noinline)) void* operator new(size_t size, const nothrow_t&) noexcept { return counted_alloc(size, 0); }
+__attribute__((noinline)) void* operator new[](size_t size, const nothrow_t&) noexcept { return counted_alloc(size, 0); }
+__attribute__((noinline)) void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return counted_alloc(size, (size_t)alignment);
+}
+__attribute__((noinline)) void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return counted_alloc(size, (size_t)alignment);
 }
 
-void reader(){
+__attribute__((noinline)) void operator delete(void* memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, align_val_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, align_val_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, size_t, align_val_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, size_t, align_val_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, const nothrow_t&) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, const nothrow_t&) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, align_val_t, const nothrow_t&) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, align_val_t, const nothrow_t&) noexcept { free(memory); }
+#endif
 
+bool allocationStats = false;
 
+// ids are kept in fixed size fields so person, elevator and assignment records are plain values that the
+// queues can copy into recycled slots without touching the heap
+const size_t idSize = 32;
 
-    string simulationStatus = init_get("http://localhost:5432/Simulation/check");
-    cout<<"inside scheduler: "<<simulationStatus <<endl;
-    while(simulationStatus == "Simulation is running.") {
+// a passenger waiting for an elevator, as read from /NextInput
+struct Person {
+    char id[idSize];
+    int startFloor;
+    int endFloor;
 
-        string nextInput = init_get("http://localhost:5432/NextInput");
-        cout<<"next input "<< nextInput<<endl;
+    // --speculate: the car picked while the reader was still handling this person, the snapshot it was
+    // picked from (0 = none), the policy and ledger version it saw and how long picking took
+    char speculativeElevator[idSize];
+    unsigned long long speculativeVersion;
+    int speculativePolicy;
+    unsigned long long speculativeLedger;
+    long long speculativeNs;
 
-        auto startTime = chrono::steady_clock::now();
+    // waiting queue: when the person was read, their priority (an optional fourth field of the record) and,
+    // for a trip no car could take yet, how often it was retried and when it is due again
+    long long arrivalNs;
+    int priority;
+    int retries;
+    long long retryAtNs;
+};
 
-        while(nextInput == "NONE"){
-            auto elapsedTime = chrono::steady_clock::now() - startTime;
-            if(elapsedTime >= chrono::seconds(20)){
+// one row of the elevator table. the first four values come from the building file, currentFloor and
+// remainingCapacity are refreshed from /ElevatorStatus
+struct Elevator {
+    char bayId[idSize];
+    int lowestFloor;
+    int highestFloor;
+    int currentFloor;
+    int remainingCapacity;
+};
 
-                simulationStatus = init_get("http://localhost:5432/Simulation/check");
+// a scheduling decision waiting to be sent with /AddPersonToElevator. elevatorId is empty when no car fits.
+// readNs and assignedNs are when the person was read and decided, for --kpi
+struct Assignment {
+    char personId[idSize];
+    char elevatorId[idSize];
+    int startFloor;
+    int endFloor;
+    long long readNs;
+    long long assignedNs;
+};
 
-                if(simulationStatus != "Simulation is running."){
-                    break;
+// copy [begin, end) into a fixed size id field, cutting it off if it is too long
+void copy_id(char (&id)[idSize], const char* begin, const char* end) {
+    size_t length = min((size_t)(end - begin), idSize - 1);
+    memcpy(id, begin, length);
+    id[length] = '\0';
+}
+
+// FIFO of fixed size records on a ring buffer that only ever grows. popped slots are reused, so once the ring
+// has room for the longest queue seen so far, pushing and popping never allocate
+template <typename T>
+class RingQueue {
+public:
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    T& front() { return slots[head]; }
+    T& operator[](size_t i) { return slots[(head + i) & (slots.size() - 1)]; }
+    const T& operator[](size_t i) const { return slots[(head + i) & (slots.size() - 1)]; }
+
+    void push_back(const T& item) {
+        if (count == slots.size()) {
+            grow();
+        }
+        slots[(head + count) & (slots.size() - 1)] = item;
+        count++;
+    }
+
+    void pop_front() {
+        head = (head + 1) & (slots.size() - 1);
+        count--;
+    }
+
+private:
+    void grow() {
+        // the capacity stays a power of two so positions wrap with a mask
+        vector<T> bigger(max<size_t>(16, slots.size() * 2));
+        for (size_t i = 0; i < count; i++) {
+            bigger[i] = (*this)[i];
+        }
+        slots.swap(bigger);
+        head = 0;
+    }
+
+    vector<T> slots;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+// bounded lock-free multi-producer/multi-consumer queue after Dmitry Vyukov's design. every cell carries a
+// sequence number that says whose turn it is: a producer may fill the cell when it equals the position, a
+// consumer may empty it when it equals the position + 1. a push or pop is one CAS on a shared position and
+// one store to the cell, and never allocates
+template <typename T>
+class MpmcQueue {
+public:
+    // capacity must be a power of two
+    explicit MpmcQueue(size_t capacity) : mask(capacity - 1), cells(new Cell[capacity]) {
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    // false when the queue is full
+    bool try_push(const T& item) {
+        size_t position = enqueuePosition.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            intptr_t turn = (intptr_t)cell.sequence.load(memory_order_acquire) - (intptr_t)position;
+            if (turn == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    cell.item = item;
+                    cell.sequence.store(position + 1, memory_order_release);
+                    return true;
                 }
+            } else if (turn < 0) {
+                return false;
+            } else {
+                position = enqueuePosition.load(memory_order_relaxed);
             }
-            chrono::milliseconds duration(500); // 0.5 seconds
-            this_thread::sleep_for(duration);
-            cout<<"sleeping"<<endl;
-            nextInput = init_get("http://localhost:5432/NextInput");
         }
-        if(simulationStatus != "Simulation is running."){
-            break;
+    }
+
+    // false when the queue is empty
+    bool try_pop(T& item) {
+        size_t position = dequeuePosition.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            intptr_t turn = (intptr_t)cell.sequence.load(memory_order_acquire) - (intptr_t)(position + 1);
+            if (turn == 0) {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    item = cell.item;
+                    cell.sequence.store(position + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (turn < 0) {
+                return false;
+            } else {
+                position = dequeuePosition.load(memory_order_relaxed);
+            }
         }
+    }
+
+    // whether the next pop would find an item
+    bool ready() const {
+        size_t position = dequeuePosition.load(memory_order_relaxed);
+        return cells[position & mask].sequence.load(memory_order_acquire) == position + 1;
+    }
 
-        // Create variables to store personID, startFloor, and endFloor
-        string personID, startFloor, endFloor;
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T item;
+    };
 
-        // Create a stringstream to parse the inputString
-        istringstream iss(nextInput);
+    size_t mask;
+    unique_ptr<Cell[]> cells;
+    // producers and consumers each get their own cache line
+    alignas(64) atomic<size_t> enqueuePosition{0};
+    alignas(64) atomic<size_t> dequeuePosition{0};
+};
 
-        // Use getline to extract the values separated by '|'
-        getline(iss, personID, '|'); // Extract personID
-        iss >> startFloor; // Extract startFloor
-        iss.ignore(); // Ignore the delimiter '|' after startFloor
-        getline(iss, endFloor); // Extract endFloor
+// the queue of people waiting for a decision. by default it is the plain FIFO it always was. with aging
+// (--priority-aging-ms) it is a max-heap: a person is served by priority plus one level for every agingNs
+// waited, so nobody waits longer than agingNs times the priority gap behind anyone. since every waiting
+// person ages at the same rate, priority * agingNs - arrivalNs orders them the same at any moment and the
+// heap never has to be rebuilt
+class WaitingQueue {
+public:
+    void set_aging(long long ns) { agingNs = ns; }
+    bool empty() const { return agingNs > 0 ? heap.empty() : fifo.empty(); }
+    size_t size() const { return agingNs > 0 ? heap.size() : fifo.size(); }
+    Person& front() { return agingNs > 0 ? heap.front() : fifo.front(); }
+    const Person& operator[](size_t i) const { return agingNs > 0 ? heap[i] : fifo[i]; }
 
-        // Check if extraction was successful
-        if (iss.fail()) {
-            // Handle extraction failure
-            cout << "Extraction failed." << endl;
+    void push_back(const Person& person) {
+        if (agingNs == 0) {
+            fifo.push_back(person);
+            return;
         }
-        cout<<"Reader : "<<"personID: "<< personID<< " startFloor: "<<startFloor<<" endFloor"<<endFloor<<endl;
+        heap.push_back(person);
+        push_heap(heap.begin(), heap.end(), served_later(agingNs));
+    }
 
-        deque <string> person;
+    void pop_front() {
+        if (agingNs == 0) {
+            fifo.pop_front();
+            return;
+        }
+        pop_heap(heap.begin(), heap.end(), served_later(agingNs));
+        heap.pop_back();
+    }
 
+private:
+    struct served_later {
+        long long agingNs;
+        explicit served_later(long long ns) : agingNs(ns) {}
+        bool operator()(const Person& a, const Person& b) const {
+            return a.priority * agingNs - a.arrivalNs < b.priority * agingNs - b.arrivalNs;
+        }
+    };
 
-        person.push_back(personID);
-        person.push_back(startFloor);
-        person.push_back(endFloor);
+    long long agingNs = 0;
+    RingQueue <Person> fifo;
+    vector <Person> heap; // only grows, so once warm pushing and popping never allocate
+};
 
-        cout<<"Person:\n";
+// how a building talks to its simulator. the pipeline only ever asks for a path such as "/NextInput" or
+// "/AddPersonToElevator/<person>/<elevator>": HttpTransport sends it to the simulator over libcurl and
+// InProcessTransport answers it from a simulated backend in the same process, with no sockets involved.
+// get returns a per thread buffer that stays valid until the thread's next get
+class Transport {
+public:
+    virtual ~Transport() {}
+    virtual const string& get(const char* path, const char* first = "", const char* second = nullptr) = 0;
+    virtual void put(const char* path, const char* first = "", const char* second = nullptr) = 0;
+};
 
-        for(int i = 0; i < person.size(); i++){
-            cout<< person[i]<<"\t";
+// low-latency mode: a waiting stage polls for up to spinNs before it parks (--spin-us), and with
+// --wakeup-stats every handoff is stamped so the woken stage can record how long it took to run
+long long spinNs = 0;
+bool wakeupStats = false;
 
-        }
-        // lock the shared queue people to make sure only one thread at a time can access it
-        lock_guard<std::mutex> lock(mtx);
-        people.push_back(person);
-        // when a person is pushed into shared people queue, notify the scheduler threads to wake up
-        cv_scheduler.notify_all();
+// the condition variable one pipeline stage hands work to the next through. notify stamps the time when
+// --wakeup-stats is on; ProfiledLock::wait spins and records the wakeup-to-run latency
+struct Handoff {
+    const char* name;
+    condition_variable cv;
+    atomic<long long> notifiedNs{0};
+    atomic<long long> spinWakeups{0};
+    atomic<long long> parkedWakeups{0};
+    // wakeup-to-run latency in power of two nanosecond buckets
+    atomic<long long> latencyBuckets[64] = {};
+    atomic<long long> maxLatencyNs{0};
 
-        cout<<"People:\n";
-        for(int i = 0; i < people.size(); i++){
-            for(int j = 0; j < people[0].size(); j++){
-                cout<< people[i][j]<<"\t";
-            }
-            cout<<endl;
+    explicit Handoff(const char* handoffName) : name(handoffName) {}
+
+    void notify_one();
+    void notify_all();
+    void record(long long waitStart, bool spun);
+};
+
+// zoning (--zones): the cars that serve exactly the same [lowestFloor, highestFloor] range form a bank, such
+// as the local cars of the low rise or the express cars from the lobby to a sky lobby. every bank has its own
+// queue and its own scheduler thread, so a tower with many banks is many small problems decided in parallel
+struct Zone {
+    int lowestFloor;
+    int highestFloor;
+    vector <size_t> cars; // rows of the bank's cars in the elevator table
+
+    WaitingQueue people;
+    mutex mtx;
+    Handoff cv{"zone scheduler"};
+    bool endOfInput = false;
+    long long decisions = 0;
+    long long lastRefreshNs = 0;
+    // --checkpoint without a refresher: the bank's cars as of its last decision, in the order of cars, copied
+    // under mtx. the rows in the elevator table are written by the zone scheduler with no lock held
+    vector <Elevator> checkpointCars;
+};
+
+// reservation ledger (--reserve <max-age-ms>). the remainingCapacity of a fetched status does not count the
+// people assigned to a car whose PUT has not gone out yet, nor the ones put after the status was fetched, so
+// a burst of people all see the same free car and overfill it. the ledger counts both per car, picks subtract
+// them from the fetched capacity, and a status fetched after a PUT settles that PUT
+struct ReservationLedger {
+    explicit ReservationLedger(size_t cars) : inFlight(new atomic<int>[cars]()), unsettled(new atomic<int>[cars]()) {}
+
+    int reserved(size_t row) const {
+        return inFlight[row].load(memory_order_relaxed) + unsettled[row].load(memory_order_relaxed);
+    }
+
+    unique_ptr<atomic<int>[]> inFlight;  // assigned, PUT not sent yet
+    unique_ptr<atomic<int>[]> unsettled; // PUT sent, not in any status fetched since
+    // bumped whenever a reserved() count changes, so a speculative pick can tell it saw an older ledger
+    atomic<unsigned long long> version{0};
+};
+
+// --kpi: a log-linear histogram of microseconds in the style of an HDR histogram. every power of two is split
+// into kpiSubBuckets linear buckets, so a quantile read back is within 1/kpiSubBuckets of the true value
+// however long the run, and the size is fixed: kpiOctaves * kpiSubBuckets counters, up to 2^42 us (50 days)
+const int kpiSubBits = 3;
+const int kpiSubBuckets = 1 << kpiSubBits;
+const int kpiOctaves = 40;
+
+struct KpiHistogram {
+    atomic<long long> buckets[kpiOctaves * kpiSubBuckets] = {};
+    atomic<long long> count{0};
+    atomic<long long> sumUs{0};
+    atomic<long long> maxUs{0};
+};
+
+// the passenger KPIs of one building: each stage between reading a person, deciding their car and the answer
+// to their PUT, plus the whole read to PUT time by direction, start floor and car. the floor and car tables are
+// sized from the building file when the run starts and never grow
+struct PassengerKpis {
+    PassengerKpis(size_t cars, int lowest, int highest)
+        : lowestFloor(lowest), floorCount((size_t)(highest - lowest + 1)), carCount(cars),
+          floors(new KpiHistogram[floorCount]), byCar(new KpiHistogram[cars]) {}
+
+    KpiHistogram decide; // read to decided
+    KpiHistogram put;    // decided to PUT answered
+    KpiHistogram total;  // read to PUT answered
+    KpiHistogram direction[2]; // up, down
+    int lowestFloor;
+    size_t floorCount;
+    size_t carCount;
+    unique_ptr<KpiHistogram[]> floors;
+    unique_ptr<KpiHistogram[]> byCar;
+    atomic<long long> noCar{0};
+    long long startNs = 0;
+};
+
+// eligibility cache: the rows of the cars whose floor range covers a trip depend only on the lower and upper
+// floor of the trip and the building file, so they are computed once per distinct trip and every repeat
+// skips the scan over all cars. entries are never changed once added, readers share the lock and only a
+// miss takes it exclusively. callers keep the returned pointers without the lock, so entries must outlive
+// every decision: the cache is keyed to the building's generation, which only changes while the building is
+// loaded, before any thread looks anything up, so the reset below only ever finds an empty cache
+struct EligibilityCache {
+    shared_mutex mtx;
+    unsigned long long generation = 0;
+    unordered_map<unsigned long long, vector <size_t>> candidates; // node based, so entries stay put when it grows
+    size_t cachedRows = 0;
+    atomic<long long> hits{0};
+    atomic<long long> misses{0};
+};
+
+// upper bound on the rows held by the cache, so a building with many cars and many distinct trips does not
+// grow it without limit. trips that do not fit are scanned every time
+const size_t eligibilityCacheRows = 1 << 24;
+
+// how pick_elevator chooses among the eligible cars with room: fill packs the car with the least room left
+// (the original rule), nearest takes the car closest to the start floor and balance the one with the most room
+enum class Policy { fill, nearest, balance };
+
+// traffic classifier (--traffic-window <people>): origin and destination histograms over the last window
+// trips of the incoming passenger stream, used to tell the regime the building is in and swap the policy
+enum class Traffic { unclassified, idle, upPeak, downPeak, interFloor };
+
+struct TrafficClassifier {
+    size_t window = 0; // 0 when off
+    int lobby = 0;     // lowest floor of the building
+    vector <int> origins;
+    vector <int> destinations;
+
+    // the window itself: start and end floor and arrival time of the last window people
+    vector <int> startFloors;
+    vector <int> endFloors;
+    vector <long long> arrivalNs;
+    size_t next = 0;
+    size_t filled = 0;
+    size_t upTrips = 0;
+    size_t sinceCheck = 0;
+
+    Traffic regime = Traffic::unclassified;
+    long long switches = 0;
+    long long peopleIn[5] = {};
+    mutex mtx;
+};
+
+// one worker of the assigner pool (--assigners <n>) and the assignments for the cars it owns. the worker
+// parks on cv only when its queue is empty; a producer takes mtx to notify only while the worker is parked
+const size_t assignerQueueSize = 1 << 14;
+
+struct AssignerShard {
+    MpmcQueue<Assignment> queue{assignerQueueSize};
+    atomic<bool> sleeping{false};
+    atomic<bool> finished{false};
+    mutex mtx;
+    condition_variable cv;
+    // touched only by the worker until it is joined
+    long long puts = 0;
+
+    void wake() {
+        // pairs with the fence in park: either the worker sees the new item or this sees it sleeping
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleeping.load(memory_order_relaxed)) {
+            lock_guard<mutex> lock(mtx);
+            cv.notify_one();
         }
+    }
+
+    void park();
+};
+
+// everything that belongs to one building: its queues, its elevator table, the simulator it talks to and the
+// mutex and condition variables that protect them. a normal run has one building, --pool runs many side by side
+struct Building {
+    string buildingFile;
+    string simulatorUrl = "http://localhost:5432";
+    unique_ptr<Transport> transport;
+
+    // queue that contains next person to handle, elevators, and assigned elevators
+    WaitingQueue people;
+    vector <Elevator> elevators;
+    RingQueue <Assignment> assignedElevator;
+    // --assigners <n> with n > 1: the assignments skip assignedElevator and go straight to the worker whose
+    // shard owns the car, so PUTs for one car leave in decision order while other cars' PUTs overlap
+    deque<AssignerShard> assignerShards;
+
+    // row of every bayID in elevators, and whether the simulator answers bulk status requests
+    unordered_map<string, size_t> elevatorIndex;
+    bool bulkStatus = false;
+
+    // bumped whenever the building configuration is (re)loaded, and the eligible cars per trip
+    unsigned long long generation = 0;
+    bool cacheEligibility = true;
+    EligibilityCache eligibility;
+
+    // status refresher: poll interval (0 = refresh inside every decision), the latest published table and how
+    // many tables have been published so far
+    int statusRefreshMs = 0;
+    shared_ptr<const vector <Elevator>> snapshot;
+    atomic<unsigned long long> snapshotVersion{0};
+    atomic<bool> refresherStop{false};
+
+    // warm-restart checkpoints (--checkpoint <file>): where and how often the state is written, whether this
+    // run resumed from a checkpoint, how many were written and how long capturing them took, waiting for the
+    // locks included
+    string checkpointPath;
+    int checkpointMs = 1000;
+    atomic<bool> checkpointStop{false};
+    bool resumed = false;
+    long long checkpointsWritten = 0;
+    long long checkpointCaptureNs = 0;
+    long long checkpointMaxCaptureNs = 0;
+
+    // --record-trace <file>: every person read, for replay in the simulator (--replay) and in sweeps
+    unique_ptr<ofstream> trace;
+    mutex traceMtx;
+    long long traceStartNs = 0;
+
+    // speculative pre-scoring: whether it is on, and how often the pre-scored pick could be used as is
+    bool speculate = false;
+    atomic<long long> speculationHits{0};
+    atomic<long long> speculationMisses{0};
+    atomic<long long> speculationSavedNs{0};
+
+    // late binding: -1 when off, otherwise how many floors closer another car must be to take over an
+    // assignment, plus how often assignments were checked and moved
+    int lateBindingMargin = -1;
+    atomic<long long> lateChecks{0};
+    atomic<long long> lateMovedFull{0};
+    atomic<long long> lateMovedCloser{0};
+    atomic<long long> lateFloorsSaved{0};
+
+    // zoning: whether it is on, the banks derived from the building file and how many of the router and
+    // per bank scheduler threads are still running
+    bool zoned = false;
+    deque <Zone> zones;
+    atomic<int> zoneThreads{0};
+
+    // reservation ledger: nullptr when off, otherwise the ledger, how old the table may get before a decision
+    // fetches status again, when the table was last fetched and how many decisions did or did not fetch
+    unique_ptr<ReservationLedger> ledger;
+    int reserveMaxAgeMs = 0;
+    long long lastRefreshNs = 0;
+    atomic<long long> ledgerRefreshes{0};
+    atomic<long long> ledgerSkippedRefreshes{0};
+
+    // anytime optimizer (--optimize-ms): time budget of one round, and what the rounds achieved. the cost
+    // checkpoints hold the summed best cost after each quarter of the budget
+    int optimizeMs = 0;
+    RingQueue <Assignment> optimizerWindow;
+    Handoff cv_optimizer{"optimizer"};
+    bool schedulingDone = false;
+    long long optimizerRounds = 0;
+    long long optimizedPeople = 0;
+    long long optimizerMoves = 0;
+    long long optimizerConverged = 0;
+    long long reassignedPeople = 0;
+    long long greedyCost = 0;
+    long long optimizedCost[4] = {};
+    long long optimizerNs = 0;
+
+    // waiting queue: people whose trip no car could take, how often they may be retried before they are
+    // assigned no car as before, and what happened to them
+    RingQueue <Person> retryLane;
+    int maxRetries = 0;
+    long long retriedPeople = 0;
+    long long gaveUpPeople = 0;
+    long long emptyDecisions = 0;
+    long long emptyDecisionNs = 0;
+
+    // --wait-stats: time from reading a person to their assignment, in power of two microsecond buckets
+    bool waitStats = false;
+    atomic<long long> waitBuckets[64] = {};
+    atomic<long long> waitCount{0};
+    atomic<long long> waitSumNs{0};
+    atomic<long long> waitMaxNs{0};
+
+    // --kpi: passenger KPIs, recorded after every PUT
+    unique_ptr<PassengerKpis> kpi;
+
+    // scheduling policy, swapped by the traffic classifier while the scheduler keeps reading it
+    atomic<Policy> policy{Policy::fill};
+    TrafficClassifier traffic;
+
+    mutex mtx;
+    Handoff cv_scheduler{"scheduler"}; // condition variable for scheduler thread
+    Handoff cv_addToElevator{"assigner"}; // condition varable for the reader
+    bool endOfInput = false;  // initialize the end of input to false
+    bool everyoneAssignedElevator = false;
+
+    // work stealing pool mode only: pending wakeups of the scheduler and assigner tasks and when the
+    // reader started seeing NONE
+    atomic<int> schedulerSignals{0};
+    atomic<int> assignerSignals{0};
+    long long idleSince = -1;
+
+    // number of /NextInput requests the reader thread keeps in flight
+    int prefetchDepth = 1;
+
+    // push listener (--listen): threads still adding people, whether the reader has stopped and how many
+    // pushers are connected right now
+    int inputSources = 1;
+    atomic<bool> readerFinished{false};
+    atomic<int> pushClients{0};
 
-        simulationStatus = init_get("http://localhost:5432/Simulation/check");
-        cout<<"READER: Simulation status: "<<simulationStatus<<endl;
+    // --alloc-stats: people read so far and the allocation count once the pipeline was warmed up
+    atomic<long long> peopleRead{0};
+    atomic<long long> warmAllocations{-1};
+};
 
+// lock contention profiling, enabled with --profile-locks.
+// every place that takes mtx has its own LockSite that records how long the thread waited to get the lock,
+// how long it held it and how many condition variable wakeups found nothing to do
+bool profileLocks = false;
+
+long long now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void atomic_max(atomic<long long>& target, long long value) {
+    long long current = target.load();
+    while (value > current && !target.compare_exchange_weak(current, value)) {
     }
-    lock_guard<std::mutex> lock(mtx);
-    // use a variable to indicate if the reader reached the end of file
-    endOfInput = true;
-    // then notify the worker threads
-    cv_scheduler.notify_all();
 }
 
-void schedule_elevator(){
-    while(true){
-        // lock the shared resources to make sure only one thread at a time accesses them
-        unique_lock<mutex> lock(mtx);
-        // wait if the shared buffer is empty and the reader has not reached the end of file yet
-        while(people.empty() && endOfInput == false) {
-            cv_scheduler.wait(lock);
-        }
+void Handoff::notify_one() {
+    if (wakeupStats) {
+        notifiedNs = now_ns();
+    }
+    cv.notify_one();
+}
 
-        if(endOfInput == true && people.empty()){
-            break;
-        }
-        deque <string> personWaitingElevator = people.front();
+void Handoff::notify_all() {
+    if (wakeupStats) {
+        notifiedNs = now_ns();
+    }
+    cv.notify_all();
+}
+
+// a waiter that started at waitStart is running again. only a notify made while it waited counts
+void Handoff::record(long long waitStart, bool spun) {
+    long long notified = notifiedNs.load();
+    if (!wakeupStats || notified < waitStart) {
+        return;
+    }
+    long long latency = max(0LL, now_ns() - notified);
+    int bucket = 0;
+    while (bucket < 63 && (1LL << bucket) < latency) {
+        bucket++;
+    }
+    latencyBuckets[bucket]++;
+    atomic_max(maxLatencyNs, latency);
+    (spun ? spinWakeups : parkedWakeups)++;
+}
 
-        string personID = personWaitingElevator[0];
-        int startFloor = stoi(personWaitingElevator[1]);
-        int endFloor = stoi(personWaitingElevator[2]);
+// tell the core that this is a spin-wait loop
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
 
-        string needUpOrDown;
-        if (endFloor - startFloor >= 0) {
-            needUpOrDown = "U";
-        } else {
-            needUpOrDown = "D";
+void AssignerShard::park() {
+    // low-latency mode: watch the queue for a while before paying for a futex wait and wakeup
+    for (long long deadline = now_ns() + spinNs; spinNs > 0 && now_ns() < deadline; ) {
+        if (queue.ready() || finished.load()) {
+            return;
         }
-        cout<<"after parsing next person"<<endl;
+        cpu_relax();
+    }
+    unique_lock<mutex> lock(mtx);
+    sleeping.store(true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!queue.ready() && !finished.load()) {
+        cv.wait(lock);
+    }
+    sleeping.store(false, memory_order_relaxed);
+}
 
-        string elevatorStatus;
+struct LockSite {
+    const char* name;
+    atomic<long long> acquisitions{0};
+    atomic<long long> waitNs{0};
+    atomic<long long> maxWaitNs{0};
+    atomic<long long> holdNs{0};
+    atomic<long long> maxHoldNs{0};
+    atomic<long long> wakeups{0};
+    atomic<long long> emptyWakeups{0};
 
-        string closestElevator;
-        size_t length = elevators.size();
+    explicit LockSite(const char* siteName);
+};
 
-        for(int i = 0; elevators.size(); i++){
-            elevatorStatus = init_get("http://localhost:5432/ElevatorStatus/" + elevators[i][0]);
+vector<LockSite*> lockSites;
 
-            string bayID, directionString, currentFloor, passengerCount, remainingCapacity;
+LockSite::LockSite(const char* siteName) : name(siteName) {
+    // sites are globals, so they are all registered before main starts any thread
+    lockSites.push_back(this);
+}
 
-            istringstream iss(elevatorStatus);
+LockSite readerPushSite("reader: push person");
+LockSite readerEndSite("reader: end of input");
+LockSite schedulerSite("scheduler: assign person");
+LockSite schedulerEndSite("scheduler: everyone assigned");
+LockSite assignerSite("assigner: add person to elevator");
+LockSite zoneSite("zone scheduler: take person");
+LockSite optimizerSite("optimizer: read and commit pending assignments");
+LockSite checkpointSite("checkpointer: capture state");
 
-            // Use getline to extract the values separated by '|'
-            if (getline(iss, bayID, '|') &&
-                getline(iss, currentFloor, '|') &&
-                getline(iss, directionString, '|') &&
-                getline(iss, passengerCount, '|') &&
-                getline(iss, remainingCapacity)) {
-                // Parsing successful, do something with the values
-            } else {
-                // Parsing failed, handle the error
-                cerr << "Error parsing elevator status." << endl;
-            }
+// drop-in replacement for unique_lock<mutex> that reports to a LockSite
+class ProfiledLock {
+public:
+    ProfiledLock(mutex& m, LockSite& lockSite) : lock(m, defer_lock), site(lockSite) {
+        long long start = profileLocks ? now_ns() : 0;
+        lock.lock();
+        if (profileLocks) {
+            heldSince = now_ns();
+            long long waited = heldSince - start;
+            site.acquisitions++;
+            site.waitNs += waited;
+            atomic_max(site.maxWaitNs, waited);
+        }
+    }
 
-            elevators[i][3] = currentFloor;
-            elevators[i][4] = remainingCapacity;
+    ~ProfiledLock() {
+        if (lock.owns_lock()) {
+            record_hold();
         }
+    }
 
-        sort(elevators.begin(), elevators.end(), sortByRemainingCapacity);
+    // wait on handoff until ready() holds. time spent inside cv.wait does not count as hold time
+    template <typename Predicate>
+    void wait(Handoff& handoff, Predicate ready) {
+        if (ready()) {
+            return;
+        }
+        long long waitStart = wakeupStats ? now_ns() : 0;
+        if (spin(ready, spinNs)) {
+            handoff.record(waitStart, true);
+            return;
+        }
+        while (!ready()) {
+            record_hold();
+            handoff.cv.wait(lock);
+            record_wakeup(ready);
+        }
+        handoff.record(waitStart, false);
+    }
 
-        for (size_t i = 0; i < length; i++) {
-            cout << "loop counter number: " << i << endl;
-            if ((stoi(elevators[i][1]) <= startFloor) &&
-                (stoi(elevators[i][2]) >= startFloor) &&
-                (stoi(elevators[i][2]) >= endFloor) &&
-                (stoi(elevators[i][1]) <= endFloor))
-            {
-                //request elevator status
-                elevatorStatus = init_get("http://localhost:5432/ElevatorStatus/" + elevators[i][0]);
-                cout << "inside the scheduling logic. Elevator Status: " << elevatorStatus << endl;
-                string bayID, directionString;
-                int currentFloor, passengerCount, remainingCapacity;
-
-                istringstream iss(elevatorStatus);
-
-                // Use getline to extract the values separated by '|'
-                if (getline(iss, bayID, '|') &&
-                    iss >> currentFloor &&
-                    iss.ignore(1, '|') &&
-                    getline(iss, directionString, '|') &&
-                    iss >> passengerCount &&
-                    iss.ignore(1, '|') &&
-                    iss >> remainingCapacity) {
-                    // Parsing successful, do something with the values
-                } else {
-                    // Parsing failed, handle the error
-                    cerr << "Error parsing elevator status." << endl;
-                }
-                cout << "currentFloor: " << currentFloor << " DirectionString: " << directionString
-                     << " passengerCount: " << passengerCount << " remainingCapacity: " << remainingCapacity << endl;
-                if (remainingCapacity > 0) {
-                    closestElevator = elevators[i][0];
-//                    if (directionString == "S") {
-//                        closestElevator = elevators[i][0];
-//                    } else if (needUpOrDown == directionString && currentFloor < startFloor && needUpOrDown == "U") {
-//                        closestElevator = elevators[i][0];
-//                    }else if (needUpOrDown == directionString && currentFloor > startFloor && needUpOrDown == "D") {
-//                        closestElevator = elevators[i][0];
-//                    }
+    // the same, but give up at deadline (a now_ns() time). returns ready()
+    template <typename Predicate>
+    bool wait_until(Handoff& handoff, long long deadline, Predicate ready) {
+        if (ready()) {
+            return true;
+        }
+        long long waitStart = wakeupStats ? now_ns() : 0;
+        if (spin(ready, min(spinNs, deadline - now_ns()))) {
+            handoff.record(waitStart, true);
+            return true;
+        }
+        while (!ready()) {
+            record_hold();
+            cv_status status = handoff.cv.wait_until(lock, chrono::steady_clock::time_point(chrono::nanoseconds(deadline)));
+            record_wakeup(ready);
+            if (status == cv_status::timeout) {
+                return ready();
+            }
+        }
+        handoff.record(waitStart, false);
+        return true;
+    }
+
+private:
+    // poll ready() for up to ns without blocking whoever holds the mutex: try_lock never waits, so the
+    // producer finishes its handoff undisturbed. true with the lock held once ready() holds; false with the
+    // lock held when the time is up
+    template <typename Predicate>
+    bool spin(Predicate ready, long long ns) {
+        if (ns <= 0) {
+            return false;
+        }
+        record_hold();
+        lock.unlock();
+        long long deadline = now_ns() + ns;
+        do {
+            for (int i = 0; i < 64; i++) {
+                cpu_relax();
+            }
+            if (lock.try_lock()) {
+                if (ready()) {
+                    record_wakeup(ready);
+                    return true;
                 }
+                lock.unlock();
+            }
+        } while (now_ns() < deadline);
+        lock.lock();
+        record_wakeup(ready);
+        return ready();
+    }
 
+    template <typename Predicate>
+    void record_wakeup(Predicate ready) {
+        if (profileLocks) {
+            heldSince = now_ns();
+            site.wakeups++;
+            if (!ready()) {
+                site.emptyWakeups++;
             }
         }
+    }
+
+    void record_hold() {
+        if (profileLocks) {
+            long long held = now_ns() - heldSince;
+            site.holdNs += held;
+            atomic_max(site.maxHoldNs, held);
+        }
+    }
+
+    unique_lock<mutex> lock;
+    LockSite& site;
+    long long heldSince = 0;
+};
+
+// print the lock sites ranked by the total time threads spent waiting for mtx
+void report_lock_profile() {
+    vector<LockSite*> ranked(lockSites);
+    sort(ranked.begin(), ranked.end(), [](const LockSite* a, const LockSite* b) {
+        return a->waitNs.load() > b->waitNs.load();
+    });
+
+    cout << "Lock contention profile (ranked by total wait):" << endl;
+    for (const LockSite* site : ranked) {
+        long long acquisitions = site->acquisitions.load();
+        long long wakeups = site->wakeups.load();
+        cout << "  " << site->name << endl
+             << "    acquisitions: " << acquisitions
+             << " wait total: " << site->waitNs.load() / 1000000.0 << " ms"
+             << " avg: " << (acquisitions ? site->waitNs.load() / 1000.0 / acquisitions : 0) << " us"
+             << " max: " << site->maxWaitNs.load() / 1000.0 << " us" << endl
+             << "    hold total: " << site->holdNs.load() / 1000000.0 << " ms"
+             << " avg: " << (acquisitions ? site->holdNs.load() / 1000.0 / acquisitions : 0) << " us"
+             << " max: " << site->maxHoldNs.load() / 1000.0 << " us" << endl
+             << "    cv wakeups: " << wakeups << " empty: " << site->emptyWakeups.load()
+             << " (" << (wakeups ? 100.0 * site->emptyWakeups.load() / wakeups : 0) << "%)" << endl;
+    }
+}
+
+// Callback function to handle the response
+size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *output) {
+    size_t totalSize = size * nmemb;
+    output->append((char*)contents, totalSize);
+    return totalSize;
+}
+
+// curl_global_init/curl_global_cleanup are not thread safe, so they run once for the whole process: before
+// main starts and after every thread, including main's own per thread curl handle, is gone
+struct CurlGlobal {
+    CurlGlobal() { curl_global_init(CURL_GLOBAL_ALL); }
+    ~CurlGlobal() { curl_global_cleanup(); }
+} curlGlobal;
+
+// per endpoint deadlines, hedged duplicates and retries for the blocking HTTP calls (--http-deadline-ms,
+// --hedge-percentile, --http-retries). without a deadline one stalled call would block its thread forever
+enum HttpEndpoint { checkEndpoint, inputEndpoint, statusEndpoint, putEndpoint, endpointCount };
+const char* const endpointNames[endpointCount] = {"check", "input", "status", "put"};
 
+struct HttpEndpointStats {
+    // latency of the successful calls, in power of two microsecond buckets
+    atomic<long long> buckets[64] = {};
+    atomic<long long> calls{0};
+    atomic<long long> timeouts{0};
+    atomic<long long> hedgesFired{0};
+    atomic<long long> hedgesWon{0};
+    atomic<long long> retries{0};
+    atomic<long long> failures{0};
+};
 
-        string nextPerson = personID + "/" + closestElevator;
-        assignedElevator.push_back(nextPerson);
+struct HttpPolicy {
+    // 0 means no deadline
+    long deadlineMs[endpointCount] = {0, 0, 0, 0};
+    // a GET still running at this percentile of its endpoint's latency gets a duplicate. 0 turns hedging off
+    double hedgePercentile = 0;
+    int retries = 0;
+    HttpEndpointStats stats[endpointCount];
+} httpPolicy;
 
-        cv_addToElevator.notify_all();
+// backoff before retry k is retryBaseMs * 2^k, jittered by a factor between 0.5 and 1.5
+const int retryBaseMs = 10;
+// a hedge delay needs this many successful calls to go on
+const long long hedgeMinSamples = 32;
+
+HttpEndpoint endpoint_of(const char* path) {
+    if (strncmp(path, "/NextInput", 10) == 0) {
+        return inputEndpoint;
+    }
+    if (strncmp(path, "/ElevatorStatus", 15) == 0) {
+        return statusEndpoint;
+    }
+    return checkEndpoint;
+}
 
-        cout<<"next person with elevator assigned: "<<nextPerson<<+"/"+closestElevator<<endl;
+// hot path HTTP: every thread keeps one curl handle, one response buffer and one url buffer and reuses them
+// for every call, so a request costs no heap allocation once the buffers have grown to size. the reused
+// handle also keeps the connection to the simulator open between calls. with hedging on, the calls run on
+// the thread's multi handle next to a second easy handle that carries the duplicate
+struct ThreadHttp {
+    CURL* curl = curl_easy_init();
+    curl_slist* headers = curl_slist_append(nullptr, "Content-Type: application/json");
+    string response;
+    string url;
+    CURL* hedge = nullptr;
+    CURLM* multi = nullptr;
+    string hedgeResponse;
+    mt19937 jitter{random_device{}()};
 
-        people.pop_front();
+    ~ThreadHttp() {
+        if (multi != nullptr) {
+            curl_easy_cleanup(hedge);
+            curl_multi_cleanup(multi);
+        }
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
     }
-    lock_guard<std::mutex> lock(mtx);;
-    // use a variable to indicate if the reader reached the end of file
-    everyoneAssignedElevator = true;
-    // then notify the worker threads
-    cv_addToElevator.notify_all();
+};
 
+ThreadHttp& thread_http() {
+    thread_local ThreadHttp http;
+    return http;
 }
 
+// build base + path + first [+ "/" + second] in the thread's url buffer
+const string& make_url(const string& base, const char* path, const char* first = "", const char* second = nullptr) {
+    string& url = thread_http().url;
+    url.assign(base).append(path).append(first);
+    if (second != nullptr) {
+        url.append("/").append(second);
+    }
+    return url;
+}
 
+// the latency below which percentile of the endpoint's successful calls finished, or -1 while there are
+// too few samples to tell
+long long hedge_delay_ns(const HttpEndpointStats& stats) {
+    long long count = 0;
+    for (const auto& bucket : stats.buckets) {
+        count += bucket.load();
+    }
+    if (httpPolicy.hedgePercentile <= 0 || count < hedgeMinSamples) {
+        return -1;
+    }
+    long long seen = 0;
+    int bucket = 0;
+    while (bucket < 63 && (seen += stats.buckets[bucket].load()) < httpPolicy.hedgePercentile / 100 * count) {
+        bucket++;
+    }
+    return (1LL << bucket) * 1000;
+}
 
-void add_person_to_elevator(){
-    while(true){
-        // lock the shared resources to make sure only one thread at a time accesses them
-        unique_lock<mutex> lock(mtx);
-        // wait if the shared buffer is empty and the reader has not reached the end of file yet
-        while(assignedElevator.empty() && everyoneAssignedElevator == false) {
-            cv_addToElevator.wait(lock);
+// run the prepared request on the thread's multi handle. after hedgeDelayNs (never when negative) the same
+// GET is sent again on the hedge handle with what is left of the deadline. the first attempt to succeed
+// wins and the other is cancelled; a failed attempt waits for the other one when it is still running
+CURLcode hedged_perform(ThreadHttp& http, const string& url, long long hedgeDelayNs, long deadlineMs,
+                        HttpEndpointStats& stats) {
+    if (http.multi == nullptr) {
+        http.multi = curl_multi_init();
+        http.hedge = curl_easy_init();
+        curl_easy_setopt(http.hedge, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(http.hedge, CURLOPT_WRITEDATA, &http.hedgeResponse);
+        curl_easy_setopt(http.hedge, CURLOPT_HTTPGET, 1L);
+    }
+    long long start = now_ns();
+    curl_multi_add_handle(http.multi, http.curl);
+    bool hedged = false;
+    bool primaryDone = false;
+    bool hedgeDone = false;
+    CURLcode primary = CURLE_OK;
+    CURLcode duplicate = CURLE_OK;
+    int running;
+    while (true) {
+        curl_multi_perform(http.multi, &running);
+        int left;
+        while (CURLMsg* message = curl_multi_info_read(http.multi, &left)) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            if (message->easy_handle == http.curl) {
+                primaryDone = true;
+                primary = message->data.result;
+            } else {
+                hedgeDone = true;
+                duplicate = message->data.result;
+            }
         }
+        if ((primaryDone && primary == CURLE_OK) || (hedgeDone && duplicate == CURLE_OK) ||
+            (primaryDone && (!hedged || hedgeDone))) {
+            break;
+        }
+        long long elapsed = now_ns() - start;
+        if (!hedged && !primaryDone && hedgeDelayNs >= 0 && elapsed >= hedgeDelayNs) {
+            long remainingMs = deadlineMs > 0 ? max(1L, deadlineMs - (long)(elapsed / 1000000)) : 0;
+            http.hedgeResponse.clear();
+            curl_easy_setopt(http.hedge, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(http.hedge, CURLOPT_TIMEOUT_MS, remainingMs);
+            curl_multi_add_handle(http.multi, http.hedge);
+            hedged = true;
+            stats.hedgesFired++;
+            continue;
+        }
+        int waitMs = 1000;
+        if (!hedged && hedgeDelayNs >= 0) {
+            waitMs = (int)max(1LL, (hedgeDelayNs - elapsed + 999999) / 1000000);
+        }
+        curl_multi_poll(http.multi, nullptr, 0, waitMs, nullptr);
+    }
+    curl_multi_remove_handle(http.multi, http.curl);
+    if (hedged) {
+        curl_multi_remove_handle(http.multi, http.hedge);
+    }
+    if (primaryDone && primary == CURLE_OK) {
+        return CURLE_OK;
+    }
+    if (hedgeDone && duplicate == CURLE_OK) {
+        http.response.swap(http.hedgeResponse);
+        stats.hedgesWon++;
+        return CURLE_OK;
+    }
+    return primary;
+}
 
-        if(everyoneAssignedElevator == true && assignedElevator.empty()){
+// perform the request prepared on the thread's handle under the endpoint's deadline. a GET is retried on
+// any failure, a PUT only when the connection was never made, so a person is not put twice. the latency
+// of a successful call feeds the endpoint's hedge delay
+CURLcode http_perform(ThreadHttp& http, const string& url, HttpEndpoint endpoint, bool idempotent) {
+    HttpEndpointStats& stats = httpPolicy.stats[endpoint];
+    long deadlineMs = httpPolicy.deadlineMs[endpoint];
+    curl_easy_setopt(http.curl, CURLOPT_TIMEOUT_MS, deadlineMs);
+    stats.calls++;
+    long long start = now_ns();
+    CURLcode res;
+    for (int attempt = 0; ; attempt++) {
+        if (httpPolicy.hedgePercentile > 0) {
+            // /NextInput hands out a new person on every call, a duplicate would lose one
+            bool hedge = idempotent && endpoint != inputEndpoint;
+            res = hedged_perform(http, url, hedge ? hedge_delay_ns(stats) : -1, deadlineMs, stats);
+        } else {
+            res = curl_easy_perform(http.curl);
+        }
+        if (res == CURLE_OPERATION_TIMEDOUT) {
+            stats.timeouts++;
+        }
+        if (res == CURLE_OK || attempt >= httpPolicy.retries || (!idempotent && res != CURLE_COULDNT_CONNECT)) {
             break;
         }
+        stats.retries++;
+        uniform_real_distribution<double> jitter(0.5, 1.5);
+        this_thread::sleep_for(chrono::microseconds((long long)(retryBaseMs * 1000.0 * (1 << min(attempt, 10)) *
+                                                                jitter(http.jitter))));
+        http.response.clear();
+    }
+    if (res != CURLE_OK) {
+        stats.failures++;
+        http.response.clear();
+        return res;
+    }
+    long long micros = (now_ns() - start) / 1000;
+    int bucket = 0;
+    while (bucket < 63 && (1LL << bucket) < micros) {
+        bucket++;
+    }
+    stats.buckets[bucket]++;
+    return res;
+}
 
-        string addToElevator = "http://localhost:5432/AddPersonToElevator/" + assignedElevator.front();
-        init_put(addToElevator);
-        assignedElevator.pop_front();
+// GET into the thread's response buffer. the returned reference is only valid until the next http_get
+const string& http_get(const string& url, HttpEndpoint endpoint) {
+    ThreadHttp& http = thread_http();
+    http.response.clear();
+    curl_easy_setopt(http.curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(http.curl, CURLOPT_CUSTOMREQUEST, nullptr);
+    curl_easy_setopt(http.curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(http.curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_easy_setopt(http.curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(http.curl, CURLOPT_WRITEDATA, &http.response);
+    CURLcode res = http_perform(http, url, endpoint, true);
+    if (res != CURLE_OK) {
+        std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
     }
+    return http.response;
+}
 
+void http_put(const string& url) {
+    ThreadHttp& http = thread_http();
+    http.response.clear();
+    curl_easy_setopt(http.curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(http.curl, CURLOPT_HTTPHEADER, http.headers);
+    curl_easy_setopt(http.curl, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(http.curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(http.curl, CURLOPT_WRITEDATA, &http.response);
+    CURLcode res = http_perform(http, url, putEndpoint, false);
+    if (res != CURLE_OK) {
+        std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+    }
 }
 
-int main(int argc, char* argv[]) {
-    // Check if at least one command-line argument (besides the program name) is provided
-    if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " <input_building_file>" << endl;
-        return 1; // Return error code 1 indicating incorrect usage
+// the event loop and the prefetcher run their own transfers under the same deadlines but do not hedge or
+// retry. they only count the calls, their outcome and their latency
+void count_async_result(CURL* curl, HttpEndpoint endpoint, CURLcode res) {
+    HttpEndpointStats& stats = httpPolicy.stats[endpoint];
+    stats.calls++;
+    if (res == CURLE_OPERATION_TIMEDOUT) {
+        stats.timeouts++;
+    }
+    if (res != CURLE_OK) {
+        stats.failures++;
+        return;
+    }
+    curl_off_t micros = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &micros);
+    int bucket = 0;
+    while (bucket < 63 && (1LL << bucket) < micros) {
+        bucket++;
     }
+    stats.buckets[bucket]++;
+}
 
-    // Extract the input building file path from the command-line arguments
-    string input_building = argv[1];
-    // Open the file
-    ifstream file(input_building);
-    if (!file.is_open()) {
-        cerr << "Error opening file." << endl;
-        return 1;
+class HttpTransport : public Transport {
+public:
+    explicit HttpTransport(const string& simulatorUrl) : baseUrl(simulatorUrl) {}
+
+    const string& get(const char* path, const char* first, const char* second) override {
+        return http_get(make_url(baseUrl, path, first, second), endpoint_of(path));
     }
 
-    string line;
-    while (getline(file, line)) {
-        istringstream iss(line);
-        string token;
+    void put(const char* path, const char* first, const char* second) override {
+        http_put(make_url(baseUrl, path, first, second));
+    }
 
-        // Vector for the current elevator
-        std::deque<std::string> elevator;
+private:
+    string baseUrl;
+};
 
-        while (std::getline(iss, token, '\t')) {
-            elevator.push_back(token);
+// stand-in for the simulator that lives in the process (--in-process <people>). it hands out a fixed number of
+// generated people as fast as they are asked for and keeps a rough passenger count per car, enough to measure
+// pure scheduling throughput without the network or to embed a simulator for capacity planning runs
+class SimulatedBackend {
+public:
+    SimulatedBackend(const vector <Elevator>& elevators, long long people) : cars(elevators), totalPeople(people) {
+        for (size_t i = 0; i < cars.size(); i++) {
+            carIndex[cars[i].bayId] = i;
+            capacity.push_back(cars[i].remainingCapacity);
         }
+    }
 
-        // Push the current elevator vector to elevators
-        elevators.push_back(elevator);
+    // answer a GET for path into response
+    void get(const string& path, string& response) {
+        lock_guard<mutex> lock(mtx);
+        char line[128];
+        if (path == "/Simulation/check") {
+            response = handedOut < totalPeople ? "Simulation is running." : "Simulation is complete.";
+        } else if (path == "/NextInput") {
+            if (handedOut >= totalPeople || cars.empty()) {
+                response = "NONE";
+                return;
+            }
+            // a trip inside the range of a random car, so there is always some car that can serve it
+            const Elevator& car = cars[generator() % cars.size()];
+            uniform_int_distribution<int> floor(car.lowestFloor, car.highestFloor);
+            snprintf(line, sizeof(line), "%lld|%d|%d", ++handedOut, floor(generator), floor(generator));
+            response = line;
+            // every arrival is one tick of simulated time in which each busy car lets one passenger off
+            for (size_t i = 0; i < cars.size(); i++) {
+                if (cars[i].remainingCapacity < capacity[i]) {
+                    cars[i].remainingCapacity++;
+                    cars[i].currentFloor = floor(generator) % (cars[i].highestFloor - cars[i].lowestFloor + 1) + cars[i].lowestFloor;
+                }
+            }
+        } else if (path == "/ElevatorStatus/all") {
+            response.clear();
+            for (size_t i = 0; i < cars.size(); i++) {
+                append_status(i, response);
+            }
+        } else if (path.compare(0, 21, "/ElevatorStatus/bulk/") == 0) {
+            response.clear();
+            const char* id = path.c_str() + 21;
+            while (*id != '\0') {
+                const char* comma = strchr(id, ',');
+                key.assign(id, comma ? comma - id : strlen(id));
+                auto found = carIndex.find(key);
+                if (found != carIndex.end()) {
+                    append_status(found->second, response);
+                }
+                id = comma ? comma + 1 : id + strlen(id);
+            }
+        } else if (path.compare(0, 16, "/ElevatorStatus/") == 0) {
+            const Elevator* car = find_car(path.c_str() + 16);
+            if (car == nullptr) {
+                response = "NONE";
+                return;
+            }
+            response.clear();
+            append_status(car - cars.data(), response);
+            response.pop_back();
+        } else {
+            response = "NONE";
+        }
     }
 
-    // Close the file
-    file.close();
+    void put(const string& path) {
+        lock_guard<mutex> lock(mtx);
+        if (path.compare(0, 21, "/AddPersonToElevator/") == 0) {
+            const char* slash = strchr(path.c_str() + 21, '/');
+            Elevator* car = slash ? find_car(slash + 1) : nullptr;
+            if (car != nullptr && car->remainingCapacity > 0) {
+                car->remainingCapacity--;
+            } else if (car != nullptr) {
+                overfilled++;
+            }
+            assigned++;
+        }
+    }
+
+    long long assignedPeople() {
+        lock_guard<mutex> lock(mtx);
+        return assigned;
+    }
+
+    // people put into a car that had no room left
+    long long overfilledPeople() {
+        lock_guard<mutex> lock(mtx);
+        return overfilled;
+    }
+
+private:
+    // one "bayID|currentFloor|direction|passengerCount|remainingCapacity" line
+    void append_status(size_t i, string& response) {
+        char line[128];
+        snprintf(line, sizeof(line), "%s|%d|S|%d|%d\n", cars[i].bayId, cars[i].currentFloor,
+                 capacity[i] - cars[i].remainingCapacity, cars[i].remainingCapacity);
+        response.append(line);
+    }
+
+    Elevator* find_car(const char* bayId) {
+        key.assign(bayId);
+        auto found = carIndex.find(key);
+        return found == carIndex.end() ? nullptr : &cars[found->second];
+    }
+
+    mutex mtx;
+    vector <Elevator> cars;
+    vector <int> capacity;
+    unordered_map<string, size_t> carIndex;
+    string key;
+    mt19937 generator{12345};
+    long long totalPeople;
+    long long handedOut = 0;
+    long long assigned = 0;
+    long long overfilled = 0;
+};
+
+class InProcessTransport : public Transport {
+public:
+    explicit InProcessTransport(SimulatedBackend& simulatedBackend) : backend(simulatedBackend) {}
+
+    const string& get(const char* path, const char* first, const char* second) override {
+        Buffers& buffers = thread_buffers();
+        backend.get(make_path(buffers.path, path, first, second), buffers.response);
+        return buffers.response;
+    }
+
+    void put(const char* path, const char* first, const char* second) override {
+        backend.put(make_path(thread_buffers().path, path, first, second));
+    }
+
+private:
+    struct Buffers {
+        string path;
+        string response;
+    };
 
-    for(int i = 0; i < elevators.size(); i++){
-        for(int j = 0; j < elevators[0].size(); j++){
-            cout << elevators[i][j]<<"\t";
+    static Buffers& thread_buffers() {
+        thread_local Buffers buffers;
+        return buffers;
+    }
+
+    static const string& make_path(string& buffer, const char* path, const char* first, const char* second) {
+        buffer.assign(path).append(first);
+        if (second != nullptr) {
+            buffer.append("/").append(second);
         }
-        cout<<endl;
+        return buffer;
     }
 
-    init_put("http://localhost:5432/Simulation/start");
-    thread read(reader);
-    thread schedule(schedule_elevator);
-    thread addToElevator(add_person_to_elevator);
+    SimulatedBackend& backend;
+};
+
+const string& simulation_status(const Building& b) {
+    return b.transport->get("/Simulation/check");
+}
+
+bool simulation_running(const Building& b) {
+    return simulation_status(b) == "Simulation is running.";
+}
 
-    read.join();
-    schedule.join();
-    addToElevator.join();
+// split a /NextInput response "personID|startFloor|endFloor" into a person record
+bool parse_next_input(const string& nextInput, Person& person){
+    person.speculativeVersion = 0;
+    person.arrivalNs = now_ns();
+    person.priority = 0;
+    person.retries = 0;
+    const char* begin = nextInput.c_str();
+    const char* bar = strchr(begin, '|');
+    char* end = nullptr;
+    bool ok = bar != nullptr;
+    if (ok) {
+        copy_id(person.id, begin, bar);
+        person.startFloor = (int)strtol(bar + 1, &end, 10);
+        ok = end != bar + 1 && *end == '|';
+    }
+    if (ok) {
+        const char* endFloor = end + 1;
+        person.endFloor = (int)strtol(endFloor, &end, 10);
+        ok = end != endFloor;
+    }
+    if (ok && *end == '|') {
+        person.priority = (int)strtol(end + 1, nullptr, 10);
+    }
+
+    // Check if extraction was successful
+    if (!ok) {
+        // Handle extraction failure
+        cout << "Extraction failed." << endl;
+        return false;
+    }
+    cout<<"Reader : "<<"personID: "<< person.id<< " startFloor: "<<person.startFloor<<" endFloor"<<person.endFloor<<endl;
+    return true;
+}
+
+// parse an /ElevatorStatus response "bayID|currentFloor|direction|passengerCount|remainingCapacity"
+// and store the current floor and remaining capacity in row i of an elevator table
+void update_elevator_status(vector <Elevator>& elevators, size_t i, const char* elevatorStatus){
+    // skip bayID, then read currentFloor, skip the direction, read passengerCount and remainingCapacity
+    const char* field = strchr(elevatorStatus, '|');
+    char* end = nullptr;
+    int currentFloor = 0, remainingCapacity = 0;
+    bool ok = field != nullptr;
+    if (ok) {
+        currentFloor = (int)strtol(field + 1, &end, 10);
+        ok = end != field + 1 && *end == '|';
+    }
+    if (ok) {
+        field = strchr(end + 1, '|');
+        ok = field != nullptr;
+    }
+    if (ok) {
+        strtol(field + 1, &end, 10);
+        ok = end != field + 1 && *end == '|';
+    }
+    if (ok) {
+        field = end;
+        remainingCapacity = (int)strtol(field + 1, &end, 10);
+        ok = end != field + 1;
+    }
+    if (ok) {
+        elevators[i].currentFloor = currentFloor;
+        elevators[i].remainingCapacity = remainingCapacity;
+    } else {
+        // Parsing failed, keep the last known values
+        cerr << "Error parsing elevator status." << endl;
+    }
+}
+
+// bulk status: "/ElevatorStatus/all" answers with one status line per car of the building and
+// "/ElevatorStatus/bulk/<id>,<id>,..." with one line per listed car, so a refresh is one round trip instead
+// of one per car. simulators that do not know these paths get the per car requests instead
+
+// apply every line of a bulk status answer to an elevator table in one pass. returns the number of rows updated
+size_t apply_bulk_status(const Building& b, vector <Elevator>& elevators, const string& statusLines){
+    thread_local string bayID;
+    size_t updated = 0;
+    const char* line = statusLines.c_str();
+    while (*line != '\0') {
+        const char* bar = strchr(line, '|');
+        const char* newline = strchr(line, '\n');
+        if (bar != nullptr && (newline == nullptr || bar < newline)) {
+            bayID.assign(line, bar - line);
+            auto found = b.elevatorIndex.find(bayID);
+            if (found != b.elevatorIndex.end()) {
+                update_elevator_status(elevators, found->second, line);
+                updated++;
+            }
+        }
+        if (newline == nullptr) {
+            break;
+        }
+        line = newline + 1;
+    }
+    return updated;
+}
+
+// called once at startup: use the bulk request only if the simulator answers it with known cars
+void probe_bulk_status(Building& b){
+    b.bulkStatus = !b.elevators.empty() && apply_bulk_status(b, b.elevators, b.transport->get("/ElevatorStatus/all")) > 0;
+    cout << "Bulk elevator status " << (b.bulkStatus ? "supported" : "not supported, using one request per car") << endl;
+}
+
+// ask the simulator for the status of every car of the building, or only of the rows in subset, and store it
+// in elevators (the building's own table, or the refresher's working copy)
+void refresh_elevator_status(Building& b, vector <Elevator>& elevators, const vector <size_t>* subset = nullptr){
+    if (b.bulkStatus) {
+        if (subset == nullptr) {
+            apply_bulk_status(b, elevators, b.transport->get("/ElevatorStatus/all"));
+            return;
+        }
+        thread_local string idList;
+        idList.clear();
+        for (size_t i : *subset) {
+            idList.append(idList.empty() ? "" : ",").append(elevators[i].bayId);
+        }
+        apply_bulk_status(b, elevators, b.transport->get("/ElevatorStatus/bulk/", idList.c_str()));
+        return;
+    }
+    size_t count = subset ? subset->size() : elevators.size();
+    for (size_t n = 0; n < count; n++) {
+        size_t i = subset ? (*subset)[n] : n;
+        update_elevator_status(elevators, i, b.transport->get("/ElevatorStatus/", elevators[i].bayId).c_str());
+    }
+}
+
+// floors between a car and the floor a person waits on
+int pickup_distance(const Elevator& elevator, int startFloor){
+    return abs(elevator.currentFloor - startFloor);
+}
+
+// choose an elevator for a trip from the elevator table, or only from the rows in subset. a car is eligible
+// when its floor range covers both floors and it still has room; with the fill policy the one with the least
+// remaining capacity wins, which is the car the old sort-by-capacity-then-scan picked. returns nullptr when no
+// car is eligible
+// with a ledger the capacity counted is what is left after the car's reservations
+int free_capacity(const vector <Elevator>& elevators, size_t row, const ReservationLedger* ledger){
+    return elevators[row].remainingCapacity - (ledger ? ledger->reserved(row) : 0);
+}
+
+const Elevator* pick_elevator(const vector <Elevator>& elevators, int startFloor, int endFloor,
+                              const vector <size_t>* subset = nullptr, const ReservationLedger* ledger = nullptr,
+                              Policy policy = Policy::fill){
+    const Elevator* closestElevator = nullptr;
+    int closestCapacity = 0;
+    size_t count = subset ? subset->size() : elevators.size();
+    for (size_t n = 0; n < count; n++) {
+        size_t row = subset ? (*subset)[n] : n;
+        const Elevator& elevator = elevators[row];
+        if ((elevator.lowestFloor <= startFloor) &&
+            (elevator.highestFloor >= startFloor) &&
+            (elevator.highestFloor >= endFloor) &&
+            (elevator.lowestFloor <= endFloor))
+        {
+            int capacity = free_capacity(elevators, row, ledger);
+            bool better = closestElevator == nullptr ||
+                (policy == Policy::fill && capacity <= closestCapacity) ||
+                (policy == Policy::balance && capacity > closestCapacity) ||
+                (policy == Policy::nearest &&
+                 pickup_distance(elevator, startFloor) < pickup_distance(*closestElevator, startFloor));
+            if (capacity > 0 && better) {
+                closestElevator = &elevator;
+                closestCapacity = capacity;
+            }
+        }
+    }
+    return closestElevator;
+}
+
+// group the cars into banks by their floor range
+void build_zones(Building& b){
+    map<pair<int, int>, size_t> bankOf;
+    for (size_t i = 0; i < b.elevators.size(); i++) {
+        pair<int, int> range(b.elevators[i].lowestFloor, b.elevators[i].highestFloor);
+        auto found = bankOf.find(range);
+        if (found == bankOf.end()) {
+            found = bankOf.emplace(range, b.zones.size()).first;
+            b.zones.emplace_back();
+            b.zones.back().lowestFloor = range.first;
+            b.zones.back().highestFloor = range.second;
+        }
+        b.zones[found->second].cars.push_back(i);
+    }
+    for (Zone& zone : b.zones) {
+        for (size_t row : zone.cars) {
+            zone.checkpointCars.push_back(b.elevators[row]);
+        }
+    }
+    cout << "Derived " << b.zones.size() << " zones from " << b.buildingFile << endl;
+    if (b.zones.size() <= 50) {
+        for (const Zone& zone : b.zones) {
+            cout << "  floors " << zone.lowestFloor << "-" << zone.highestFloor << ": " << zone.cars.size() << " cars" << endl;
+        }
+    }
+}
+
+// the best bank for a trip is the one with the narrowest range that still covers both floors: an express
+// bank serves its sky lobby only, so it never takes a trip a local bank could serve and a long trip is never
+// given to a car that stops short. returns nullptr when no bank covers the trip
+Zone* route_zone(Building& b, int startFloor, int endFloor){
+    Zone* best = nullptr;
+    for (Zone& zone : b.zones) {
+        if (zone.lowestFloor <= min(startFloor, endFloor) && zone.highestFloor >= max(startFloor, endFloor) &&
+            (best == nullptr || zone.highestFloor - zone.lowestFloor < best->highestFloor - best->lowestFloor)) {
+            best = &zone;
+        }
+    }
+    return best;
+}
+
+// rows of the cars whose range covers both floors, in table order, or nullptr when the cache is off or full
+// and the caller has to scan every car
+const vector <size_t>* eligible_cars(Building& b, int startFloor, int endFloor){
+    if (!b.cacheEligibility) {
+        return nullptr;
+    }
+    EligibilityCache& cache = b.eligibility;
+    int lower = min(startFloor, endFloor), upper = max(startFloor, endFloor);
+    // built from unsigned values: shifting a negative (basement) floor left is undefined
+    unsigned long long key = (unsigned long long)(uint32_t)lower << 32 | (uint32_t)upper;
+    {
+        shared_lock<shared_mutex> lock(cache.mtx);
+        if (cache.generation == b.generation) {
+            auto found = cache.candidates.find(key);
+            if (found != cache.candidates.end()) {
+                cache.hits++;
+                return &found->second;
+            }
+        }
+    }
+    unique_lock<shared_mutex> lock(cache.mtx);
+    if (cache.generation != b.generation) {
+        // clearing a cache that was already handed out would leave the callers with dangling pointers
+        assert(cache.candidates.empty());
+        cache.candidates.clear();
+        cache.cachedRows = 0;
+        cache.generation = b.generation;
+    }
+    auto found = cache.candidates.find(key);
+    if (found != cache.candidates.end()) {
+        cache.hits++;
+        return &found->second;
+    }
+    cache.misses++;
+    // count first, so a miss allocates the list once instead of growing it car by car
+    auto covers = [&](const Elevator& elevator) { return elevator.lowestFloor <= lower && elevator.highestFloor >= upper; };
+    size_t count = count_if(b.elevators.begin(), b.elevators.end(), covers);
+    if (cache.cachedRows + count > eligibilityCacheRows) {
+        return nullptr;
+    }
+    vector <size_t> rows;
+    rows.reserve(count);
+    for (size_t i = 0; i < b.elevators.size(); i++) {
+        if (covers(b.elevators[i])) {
+            rows.push_back(i);
+        }
+    }
+    cache.cachedRows += count;
+    return &cache.candidates.emplace(key, move(rows)).first->second;
+}
+
+void report_eligibility(deque <Building>& buildings){
+    cout << "Eligibility cache:" << endl;
+    for (Building& b : buildings) {
+        long long hits = b.eligibility.hits.load();
+        long long total = hits + b.eligibility.misses.load();
+        cout << "  " << b.buildingFile << ": " << b.eligibility.candidates.size() << " trips cached, "
+             << hits << "/" << total << " hits (" << (total ? 100.0 * hits / total : 0) << "%), "
+             << b.eligibility.cachedRows << " candidate rows" << endl;
+    }
+}
+
+// pick from the bank a trip is routed to and, when all of its cars are full, from any car covering the trip.
+// only for tables no scheduler writes to while we read them: snapshots and the event loop's table
+const Elevator* pick_routed(Building& b, const vector <Elevator>& elevators, int startFloor, int endFloor){
+    Policy policy = b.policy.load(memory_order_relaxed);
+    if (!b.zoned) {
+        return pick_elevator(elevators, startFloor, endFloor, eligible_cars(b, startFloor, endFloor), b.ledger.get(), policy);
+    }
+    Zone* zone = route_zone(b, startFloor, endFloor);
+    if (zone == nullptr) {
+        return nullptr;
+    }
+    const Elevator* closestElevator = pick_elevator(elevators, startFloor, endFloor, &zone->cars, b.ledger.get(), policy);
+    return closestElevator != nullptr ? closestElevator
+        : pick_elevator(elevators, startFloor, endFloor, eligible_cars(b, startFloor, endFloor), b.ledger.get(), policy);
+}
+
+// row of a car in the elevator table, -1 for an unknown or empty bayID
+long long elevator_row(const Building& b, const char* bayId){
+    if (bayId[0] == '\0') {
+        return -1;
+    }
+    thread_local string key;
+    key.assign(bayId);
+    auto found = b.elevatorIndex.find(key);
+    return found == b.elevatorIndex.end() ? -1 : (long long)found->second;
+}
+
+// ledger bookkeeping: a decision reserves room in its car, late binding moves the reservation, the PUT turns
+// it into an unsettled one and a status fetched after the PUT settles it
+void reserve_car(Building& b, const Assignment& assignment){
+    long long row = b.ledger ? elevator_row(b, assignment.elevatorId) : -1;
+    if (row >= 0) {
+        b.ledger->inFlight[row]++;
+        b.ledger->version++;
+    }
+}
+
+void move_reservation(Building& b, size_t from, size_t to){
+    if (b.ledger) {
+        b.ledger->inFlight[to]++;
+        b.ledger->inFlight[from]--;
+        b.ledger->version++;
+    }
+}
+
+void car_put(Building& b, const Assignment& assignment){
+    long long row = b.ledger ? elevator_row(b, assignment.elevatorId) : -1;
+    if (row >= 0) {
+        // count it as unsettled before it stops being in flight, so the car is never briefly undercounted
+        b.ledger->unsettled[row]++;
+        b.ledger->inFlight[row]--;
+    }
+}
+
+// a status refresh takes the unsettled counts before it fetches and subtracts them once the fetched table is
+// the one picks read: PUTs sent while the request was out may or may not be in it, so they stay reserved
+// until the next refresh
+void capture_unsettled(Building& b, vector <int>& captured, const vector <size_t>* subset = nullptr){
+    if (!b.ledger) {
+        return;
+    }
+    size_t count = subset ? subset->size() : b.elevators.size();
+    captured.resize(count);
+    for (size_t n = 0; n < count; n++) {
+        captured[n] = b.ledger->unsettled[subset ? (*subset)[n] : n].load();
+    }
+}
+
+void settle_reservations(Building& b, const vector <int>& captured, const vector <size_t>* subset = nullptr){
+    if (!b.ledger) {
+        return;
+    }
+    for (size_t n = 0; n < captured.size(); n++) {
+        if (captured[n] != 0) {
+            b.ledger->unsettled[subset ? (*subset)[n] : n] -= captured[n];
+            b.ledger->version++;
+        }
+    }
+}
+
+// turn the decision for a person into the assignment the assigner sends
+Assignment make_assignment(const Person& person, const Elevator* closestElevator) {
+    Assignment assignment;
+    memcpy(assignment.personId, person.id, idSize);
+    assignment.startFloor = person.startFloor;
+    assignment.endFloor = person.endFloor;
+    assignment.readNs = person.arrivalNs;
+    assignment.assignedNs = now_ns();
+    if (closestElevator != nullptr) {
+        memcpy(assignment.elevatorId, closestElevator->bayId, idSize);
+    } else {
+        assignment.elevatorId[0] = '\0';
+    }
+    return assignment;
+}
+
+// background status refresher (--status-refresh-ms). instead of the scheduler fetching every car's status
+// while it decides, a refresher polls the simulator at a fixed rate into its own copy of the table and
+// publishes each result as an immutable snapshot with an atomic shared_ptr swap. the scheduler loads the
+// latest snapshot without taking any lock, so no network time is spent inside a decision
+void publish_snapshot(Building& b, const vector <Elevator>& elevators){
+    atomic_store(&b.snapshot, shared_ptr<const vector <Elevator>>(make_shared<vector <Elevator>>(elevators)));
+    b.snapshotVersion++;
+}
+
+shared_ptr<const vector <Elevator>> latest_snapshot(const Building& b){
+    return atomic_load(&b.snapshot);
+}
+
+void status_refresher(Building& b){
+    vector <Elevator> elevators = b.elevators;
+    vector <int> captured;
+    while (!b.refresherStop) {
+        capture_unsettled(b, captured);
+        refresh_elevator_status(b, elevators);
+        publish_snapshot(b, elevators);
+        settle_reservations(b, captured);
+        this_thread::sleep_for(chrono::milliseconds(b.statusRefreshMs));
+    }
+}
+
+// the scheduling decision for one person: with the refresher, pick from the latest snapshot; without it,
+// refresh the current floor and remaining capacity of every car first, then pick one. with zoning only the
+// cars of the person's bank are refreshed, and zone is that bank when the caller has routed already. with
+// the ledger the table is only fetched again once it is older than --reserve allows
+Assignment choose_elevator(Building& b, const Person& person, Zone* zone){
+    if (b.statusRefreshMs > 0) {
+        while (true) {
+            unsigned long long version = b.snapshotVersion.load();
+            shared_ptr<const vector <Elevator>> snapshot = latest_snapshot(b);
+            // the pre-scored pick is what we would compute now if the snapshot, the policy and the ledger's
+            // reservations are all still the ones it saw
+            bool hit = b.speculate && person.speculativeVersion != 0 && person.speculativeVersion == version &&
+                       person.speculativePolicy == (int)b.policy.load(memory_order_relaxed) &&
+                       (!b.ledger || person.speculativeLedger == b.ledger->version.load());
+            Assignment assignment = make_assignment(person, hit ? nullptr
+                : pick_routed(b, *snapshot, person.startFloor, person.endFloor));
+            // a refresh settles reservations right after it publishes, so a pick that saw the ledger and an
+            // older snapshot may have undercounted a car: pick again from the new one
+            if (b.ledger && b.snapshotVersion.load() != version) {
+                continue;
+            }
+            if (hit) {
+                b.speculationHits++;
+                b.speculationSavedNs += person.speculativeNs;
+                memcpy(assignment.elevatorId, person.speculativeElevator, idSize);
+            } else if (b.speculate) {
+                b.speculationMisses++;
+            }
+            return assignment;
+        }
+    }
+    const vector <size_t>* subset = nullptr;
+    const vector <size_t>* candidates = nullptr;
+    long long* lastRefreshNs = &b.lastRefreshNs;
+    if (b.zoned) {
+        if (zone == nullptr) {
+            zone = route_zone(b, person.startFloor, person.endFloor);
+        }
+        if (zone == nullptr) {
+            return make_assignment(person, nullptr);
+        }
+        // the other banks' rows may be written by their own schedulers right now, so a full bank is not
+        // overflowed into them here
+        subset = &zone->cars;
+        candidates = subset;
+        lastRefreshNs = &zone->lastRefreshNs;
+    } else {
+        candidates = eligible_cars(b, person.startFloor, person.endFloor);
+    }
+    long long now = now_ns();
+    if (!b.ledger || now - *lastRefreshNs >= b.reserveMaxAgeMs * 1000000LL) {
+        thread_local vector <int> captured;
+        capture_unsettled(b, captured, subset);
+        refresh_elevator_status(b, b.elevators, subset);
+        settle_reservations(b, captured, subset);
+        *lastRefreshNs = now;
+        b.ledgerRefreshes++;
+    } else {
+        b.ledgerSkippedRefreshes++;
+    }
+    return make_assignment(person, pick_elevator(b.elevators, person.startFloor, person.endFloor, candidates,
+                                                 b.ledger.get(), b.policy.load(memory_order_relaxed)));
+}
+
+Assignment decide_elevator(Building& b, const Person& person, Zone* zone = nullptr){
+    Assignment assignment = choose_elevator(b, person, zone);
+    reserve_car(b, assignment);
+    return assignment;
+}
+
+// speculative pre-scoring (--speculate, needs --status-refresh-ms): as soon as the reader has the floors of a
+// person it picks a car against the current snapshot, so when the person reaches the front of the queue the
+// scheduler can take that pick as is if no newer snapshot was published in between
+void speculate(Building& b, Person& person){
+    person.speculativeVersion = 0;
+    if (!b.speculate) {
+        return;
+    }
+    long long start = now_ns();
+    // read the version first: if a snapshot is published in between the pick is older than it claims and
+    // simply misses
+    unsigned long long version = b.snapshotVersion.load();
+    person.speculativePolicy = (int)b.policy.load(memory_order_relaxed);
+    person.speculativeLedger = b.ledger ? b.ledger->version.load() : 0;
+    shared_ptr<const vector <Elevator>> snapshot = latest_snapshot(b);
+    const Elevator* closestElevator = pick_routed(b, *snapshot, person.startFloor, person.endFloor);
+    if (closestElevator != nullptr) {
+        memcpy(person.speculativeElevator, closestElevator->bayId, idSize);
+    } else {
+        person.speculativeElevator[0] = '\0';
+    }
+    person.speculativeVersion = version;
+    person.speculativeNs = now_ns() - start;
+}
+
+void report_speculation(deque <Building>& buildings){
+    cout << "Speculative pre-scoring:" << endl;
+    for (Building& b : buildings) {
+        long long hits = b.speculationHits.load();
+        long long total = hits + b.speculationMisses.load();
+        cout << "  " << b.buildingFile << ": " << hits << "/" << total << " hits ("
+             << (total ? 100.0 * hits / total : 0) << "%), "
+             << (hits ? b.speculationSavedNs.load() / 1000.0 / hits : 0) << " us saved per hit, "
+             << b.speculationSavedNs.load() / 1000000.0 << " ms saved in total" << endl;
+    }
+}
+
+// late binding (--late-binding <floors>, needs --status-refresh-ms): right before the PUT goes out the
+// assignment is checked against the newest snapshot, which may be much fresher than the table it was
+// decided on if the PUT sat behind other I/O. it moves to another car when the chosen one has no room left,
+// or when another eligible car with room is more than margin floors closer to the start floor
+
+void late_bind(Building& b, Assignment& assignment){
+    if (b.lateBindingMargin < 0) {
+        return;
+    }
+    b.lateChecks++;
+    const ReservationLedger* ledger = b.ledger.get();
+    long long chosenRow = elevator_row(b, assignment.elevatorId);
+    const Elevator* target = nullptr;
+    bool full = false;
+    int saved = 0;
+    shared_ptr<const vector <Elevator>> snapshot;
+    while (true) {
+        unsigned long long version = b.snapshotVersion.load();
+        snapshot = latest_snapshot(b);
+        const Elevator* chosen = chosenRow >= 0 ? &(*snapshot)[chosenRow] : nullptr;
+        target = chosen;
+        saved = 0;
+
+        // the ledger counts this person in the chosen car already
+        full = chosen == nullptr || free_capacity(*snapshot, chosenRow, ledger) + (ledger ? 1 : 0) <= 0;
+        if (full) {
+            target = pick_routed(b, *snapshot, assignment.startFloor, assignment.endFloor);
+        } else {
+            // with zoning a closer car only counts when it is in the trip's own bank
+            const Zone* zone = b.zoned ? route_zone(b, assignment.startFloor, assignment.endFloor) : nullptr;
+            const vector <size_t>* rows = zone ? &zone->cars : eligible_cars(b, assignment.startFloor, assignment.endFloor);
+            size_t count = rows ? rows->size() : snapshot->size();
+            for (size_t n = 0; n < count; n++) {
+                size_t row = rows ? (*rows)[n] : n;
+                const Elevator& elevator = (*snapshot)[row];
+                if (elevator.lowestFloor <= min(assignment.startFloor, assignment.endFloor) &&
+                    elevator.highestFloor >= max(assignment.startFloor, assignment.endFloor) &&
+                    free_capacity(*snapshot, row, ledger) > 0 &&
+                    pickup_distance(elevator, assignment.startFloor) < pickup_distance(*target, assignment.startFloor)) {
+                    target = &elevator;
+                }
+            }
+            saved = pickup_distance(*chosen, assignment.startFloor) - pickup_distance(*target, assignment.startFloor);
+        }
+        // same as in choose_elevator: only trust ledger counts read against the snapshot they belong to
+        if (!ledger || b.snapshotVersion.load() == version) {
+            break;
+        }
+    }
+
+    if (target == nullptr || (!full && saved <= b.lateBindingMargin) ||
+        (chosenRow >= 0 && target == &(*snapshot)[chosenRow])) {
+        return;
+    }
+    memcpy(assignment.elevatorId, target->bayId, idSize);
+    if (chosenRow >= 0) {
+        move_reservation(b, chosenRow, target - snapshot->data());
+    } else if (ledger) {
+        ledger->inFlight[target - snapshot->data()]++;
+    }
+    if (full) {
+        b.lateMovedFull++;
+    } else {
+        b.lateMovedCloser++;
+        b.lateFloorsSaved += saved;
+    }
+}
+
+void report_late_binding(deque <Building>& buildings){
+    cout << "Late binding:" << endl;
+    for (Building& b : buildings) {
+        long long checks = b.lateChecks.load();
+        long long closer = b.lateMovedCloser.load();
+        long long moved = b.lateMovedFull.load() + closer;
+        cout << "  " << b.buildingFile << ": " << moved << "/" << checks << " assignments moved ("
+             << (checks ? 100.0 * moved / checks : 0) << "%), " << b.lateMovedFull.load() << " away from full cars, "
+             << closer << " to a closer car saving " << b.lateFloorsSaved.load() << " floors of pickup travel ("
+             << (closer ? (double)b.lateFloorsSaved.load() / closer : 0) << " per move)" << endl;
+    }
+}
+
+// anytime optimizer (--optimize-ms <ms>, needs --status-refresh-ms). the scheduler still assigns greedily, one
+// person at a time, but the assignments go into a decision window instead of straight to the assigner. this
+// thread takes everything in the window as one problem, runs simulated annealing from the greedy solution
+// until the time budget is spent and hands the best solution found to the assigner. whatever the scheduler
+// decides meanwhile forms the next window. the cost of a solution is the pickup distance of every person
+// plus a penalty for every person a car has no room for
+const int overloadPenalty = 100;
+
+// one decision window as an optimization problem. load and room are indexed by car row and kept between
+// rounds, only the rows a round touched are reset
+struct OptimizerProblem {
+    vector <size_t> people;              // index in the window of every person being optimized
+    vector <size_t> carOf;               // current car row of every such person
+    vector <vector <size_t>> candidates; // eligible car rows of every such person
+    vector <int> startFloors;
+    vector <int> load;                   // people of the window per car
+    vector <int> room;                   // room per car before the people of the window
+    vector <size_t> touched;
+};
+
+long long overload_cost(int load, int room){
+    return (long long)max(0, load - max(0, room)) * overloadPenalty;
+}
+
+// cost change of moving person p from their car to row
+long long move_delta(const vector <Elevator>& elevators, const OptimizerProblem& problem, size_t p, size_t row){
+    size_t from = problem.carOf[p];
+    int fromLoad = problem.load[from], toLoad = problem.load[row];
+    return pickup_distance(elevators[row], problem.startFloors[p]) - pickup_distance(elevators[from], problem.startFloors[p])
+         + overload_cost(fromLoad - 1, problem.room[from]) - overload_cost(fromLoad, problem.room[from])
+         + overload_cost(toLoad + 1, problem.room[row]) - overload_cost(toLoad, problem.room[row]);
+}
+
+void optimize_round(Building& b, vector <Assignment>& window){
+    long long start = now_ns();
+    long long budget = b.optimizeMs * 1000000LL;
+    shared_ptr<const vector <Elevator>> snapshot = latest_snapshot(b);
+    const vector <Elevator>& elevators = *snapshot;
+    thread_local OptimizerProblem problem;
+    problem.people.clear();
+    problem.carOf.clear();
+    problem.startFloors.clear();
+    problem.touched.clear();
+    problem.load.resize(elevators.size());
+    problem.room.resize(elevators.size());
+
+    // people without a car keep their assignment and are left out, and so is everyone the first half of the
+    // budget had no time to set up
+    size_t people = 0;
+    for (size_t i = 0; i < window.size() && now_ns() - start < budget / 2; i++) {
+        long long row = elevator_row(b, window[i].elevatorId);
+        if (row < 0) {
+            continue;
+        }
+        if (problem.candidates.size() <= people) {
+            problem.candidates.emplace_back();
+        }
+        vector <size_t>& candidates = problem.candidates[people++];
+        const vector <size_t>* eligible = eligible_cars(b, window[i].startFloor, window[i].endFloor);
+        if (eligible != nullptr) {
+            candidates.assign(eligible->begin(), eligible->end());
+        } else {
+            candidates.clear();
+            for (size_t car = 0; car < elevators.size(); car++) {
+                if (elevators[car].lowestFloor <= min(window[i].startFloor, window[i].endFloor) &&
+                    elevators[car].highestFloor >= max(window[i].startFloor, window[i].endFloor)) {
+                    candidates.push_back(car);
+                }
+            }
+        }
+        problem.people.push_back(i);
+        problem.carOf.push_back(row);
+        problem.startFloors.push_back(window[i].startFloor);
+        if (problem.load[row]++ == 0) {
+            problem.touched.push_back(row);
+        }
+    }
+    long long cost = 0;
+    for (size_t p = 0; p < people; p++) {
+        cost += pickup_distance(elevators[problem.carOf[p]], problem.startFloors[p]);
+    }
+    for (size_t p = 0; p < people; p++) {
+        for (size_t car : problem.candidates[p]) {
+            // the ledger counts the people of the window in their greedy car already
+            problem.room[car] = free_capacity(elevators, car, b.ledger.get()) + (b.ledger ? problem.load[car] : 0);
+        }
+    }
+    for (size_t car : problem.touched) {
+        cost += overload_cost(problem.load[car], problem.room[car]);
+    }
+    long long greedy = cost, best = cost;
+    vector <size_t> bestCarOf = problem.carOf;
+
+    // annealing: uphill moves are taken with a probability that shrinks as the budget runs out. a round
+    // that found nothing better in many moves has converged and ends before its budget
+    mt19937 generator((unsigned)start);
+    uniform_real_distribution<double> chance(0.0, 1.0);
+    long long patience = max<long long>(2000, 50 * (long long)people);
+    long long moves = 0, lastBest = 0;
+    int quarter = 0;
+    while (people > 0 && moves - lastBest < patience) {
+        long long elapsed = now_ns() - start;
+        while (quarter < 4 && elapsed >= budget * (quarter + 1) / 4) {
+            b.optimizedCost[quarter++] += best;
+        }
+        if (quarter == 4) {
+            break;
+        }
+        double temperature = 10.0 * (1.0 - (double)elapsed / budget);
+        // check the clock every few hundred moves only
+        for (int n = 0; n < 256; n++) {
+            size_t p = generator() % people;
+            const vector <size_t>& candidates = problem.candidates[p];
+            size_t row = candidates[generator() % candidates.size()];
+            moves++;
+            if (row == problem.carOf[p]) {
+                continue;
+            }
+            long long delta = move_delta(elevators, problem, p, row);
+            if (delta <= 0 || chance(generator) < exp(-delta / temperature)) {
+                problem.load[problem.carOf[p]]--;
+                if (problem.load[row]++ == 0) {
+                    problem.touched.push_back(row);
+                }
+                problem.carOf[p] = row;
+                cost += delta;
+                if (cost < best) {
+                    best = cost;
+                    bestCarOf = problem.carOf;
+                    lastBest = moves;
+                }
+            }
+        }
+    }
+    if (quarter < 4) {
+        b.optimizerConverged++;
+    }
+    for (; quarter < 4; quarter++) {
+        b.optimizedCost[quarter] += best;
+    }
+    for (size_t car : problem.touched) {
+        problem.load[car] = 0;
+    }
+
+    for (size_t p = 0; p < people; p++) {
+        Assignment& assignment = window[problem.people[p]];
+        long long row = elevator_row(b, assignment.elevatorId);
+        if ((long long)bestCarOf[p] != row) {
+            move_reservation(b, row, bestCarOf[p]);
+            memcpy(assignment.elevatorId, elevators[bestCarOf[p]].bayId, idSize);
+            b.reassignedPeople++;
+        }
+    }
+    b.optimizerRounds++;
+    b.optimizedPeople += people;
+    b.optimizerMoves += moves;
+    b.greedyCost += greedy;
+    b.optimizerNs += now_ns() - start;
+}
+
+// queue an assignment for its PUT, with b.mtx held: on assignedElevator for the single assigner thread, or
+// on the queue of the shard that owns the car. with shards late binding runs here, before the car is known to
+// be final, so a moved assignment lands with the worker that owns its new car. cars are dealt out by row;
+// an unknown car goes to the first worker. a full shard queue holds the scheduler back until it drains
+void hand_to_assigner(Building& b, const Assignment& assignment){
+    if (b.assignerShards.empty()) {
+        b.assignedElevator.push_back(assignment);
+        b.cv_addToElevator.notify_all();
+        return;
+    }
+    Assignment bound = assignment;
+    late_bind(b, bound);
+    long long row = elevator_row(b, bound.elevatorId);
+    AssignerShard& shard = b.assignerShards[row >= 0 ? (size_t)row % b.assignerShards.size() : 0];
+    while (!shard.queue.try_push(bound)) {
+        this_thread::yield();
+    }
+    shard.wake();
+}
+
+// no more assignments will be queued, with b.mtx held
+void assigning_done(Building& b){
+    b.everyoneAssignedElevator = true;
+    b.cv_addToElevator.notify_all();
+    for (AssignerShard& shard : b.assignerShards) {
+        shard.finished = true;
+        shard.wake();
+    }
+}
+
+
+void anytime_optimizer(Building& b){
+    vector <Assignment> window;
+    while (true) {
+        {
+            ProfiledLock lock(b.mtx, optimizerSite);
+            lock.wait(b.cv_optimizer, [&b] { return !b.optimizerWindow.empty() || b.schedulingDone; });
+            if (b.optimizerWindow.empty()) {
+                break;
+            }
+            window.clear();
+            while (!b.optimizerWindow.empty()) {
+                window.push_back(b.optimizerWindow.front());
+                b.optimizerWindow.pop_front();
+            }
+        }
+        // a single person has nothing to trade with
+        if (window.size() >= 2) {
+            optimize_round(b, window);
+        }
+        ProfiledLock lock(b.mtx, optimizerSite);
+        for (const Assignment& assignment : window) {
+            hand_to_assigner(b, assignment);
+        }
+    }
+    ProfiledLock lock(b.mtx, optimizerSite);
+    assigning_done(b);
+}
+
+// hand a decided assignment on, with b.mtx held: to the assigner, or to the optimizer's decision window
+void assignment_decided(Building& b, const Assignment& assignment){
+    if (b.optimizeMs > 0) {
+        b.optimizerWindow.push_back(assignment);
+        b.cv_optimizer.notify_one();
+    } else {
+        hand_to_assigner(b, assignment);
+    }
+}
+
+// every person has been decided, with b.mtx held. the optimizer lets the assigner finish after its last window
+void scheduling_done(Building& b){
+    if (b.optimizeMs > 0) {
+        b.schedulingDone = true;
+        b.cv_optimizer.notify_one();
+    } else {
+        assigning_done(b);
+    }
+}
+
+void report_optimizer(deque <Building>& buildings){
+    cout << "Anytime optimizer:" << endl;
+    for (Building& b : buildings) {
+        cout << "  " << b.buildingFile << ": " << b.optimizerRounds << " rounds over " << b.optimizedPeople
+             << " people (" << b.optimizerConverged << " converged before the deadline), " << b.optimizerMoves
+             << " moves, " << b.reassignedPeople << " people reassigned, "
+             << (b.optimizerRounds ? b.optimizerNs / 1000000.0 / b.optimizerRounds : 0) << " ms per round of a "
+             << b.optimizeMs << " ms budget" << endl;
+        cout << "    cost " << b.greedyCost << " greedy";
+        for (int quarter = 0; quarter < 4; quarter++) {
+            cout << ", " << b.optimizedCost[quarter] << " after " << 25 * (quarter + 1) << "% of the budget ("
+                 << (b.greedyCost ? 100.0 * (b.greedyCost - b.optimizedCost[quarter]) / b.greedyCost : 0) << "% lower)";
+        }
+        cout << endl;
+    }
+}
+
+const char* policy_name(Policy policy){
+    return policy == Policy::fill ? "fill" : policy == Policy::nearest ? "nearest" : "balance";
+}
+
+const char* traffic_name(Traffic regime){
+    const char* names[] = {"unclassified", "idle", "up-peak", "down-peak", "inter-floor"};
+    return names[(int)regime];
+}
+
+// up-peak packs cars at the lobby so each leaves full, down-peak spreads people over the cars that still
+// have room since they fill on the way down, and inter-floor and idle traffic take the closest car
+Policy policy_for(Traffic regime){
+    return regime == Traffic::upPeak ? Policy::fill : regime == Traffic::downPeak ? Policy::balance : Policy::nearest;
+}
+
+void init_traffic(Building& b, size_t window){
+    TrafficClassifier& t = b.traffic;
+    t.window = window;
+    int highest = 0;
+    t.lobby = b.elevators.empty() ? 0 : b.elevators[0].lowestFloor;
+    for (const Elevator& elevator : b.elevators) {
+        t.lobby = min(t.lobby, elevator.lowestFloor);
+        highest = max(highest, elevator.highestFloor);
+    }
+    t.origins.assign(max(0, highest - t.lobby + 1), 0);
+    t.destinations.assign(t.origins.size(), 0);
+    t.startFloors.assign(window, 0);
+    t.endFloors.assign(window, 0);
+    t.arrivalNs.assign(window, 0);
+}
+
+// histogram slot of a floor, -1 for floors outside the building (a pushed record can name any floor)
+long long traffic_slot(const TrafficClassifier& t, int floor){
+    long long slot = (long long)floor - t.lobby;
+    return slot >= 0 && slot < (long long)t.origins.size() ? slot : -1;
+}
+
+void count_trip(TrafficClassifier& t, size_t i, int sign){
+    long long origin = traffic_slot(t, t.startFloors[i]);
+    long long destination = traffic_slot(t, t.endFloors[i]);
+    if (origin >= 0) {
+        t.origins[origin] += sign;
+    }
+    if (destination >= 0) {
+        t.destinations[destination] += sign;
+    }
+    if (t.endFloors[i] > t.startFloors[i]) {
+        t.upTrips += sign;
+    }
+}
+
+// add one arrival to the window; every eighth of a window the regime is classified again and, if it changed,
+// the policy is swapped with a single atomic store, so the scheduler never waits for the classifier
+void observe_traffic(Building& b, const Person& person){
+    TrafficClassifier& t = b.traffic;
+    if (t.window == 0) {
+        return;
+    }
+    lock_guard<mutex> lock(t.mtx);
+    if (t.filled == t.window) {
+        count_trip(t, t.next, -1);
+    } else {
+        t.filled++;
+    }
+    t.startFloors[t.next] = person.startFloor;
+    t.endFloors[t.next] = person.endFloor;
+    t.arrivalNs[t.next] = person.arrivalNs;
+    count_trip(t, t.next, 1);
+    size_t newest = t.next;
+    t.next = (t.next + 1) % t.window;
+    t.peopleIn[(int)t.regime]++;
+
+    if (++t.sinceCheck < max<size_t>(1, t.window / 8) || t.filled < max<size_t>(1, t.window / 2)) {
+        return;
+    }
+    t.sinceCheck = 0;
+    size_t oldest = t.filled == t.window ? t.next : 0;
+    double seconds = (t.arrivalNs[newest] - t.arrivalNs[oldest]) / 1e9;
+    double rate = seconds > 0 ? (t.filled - 1) / seconds : 1e9;
+    double lobbyOrigins = t.origins.empty() ? 0 : (double)t.origins[0] / t.filled;
+    double lobbyDestinations = t.destinations.empty() ? 0 : (double)t.destinations[0] / t.filled;
+    double up = (double)t.upTrips / t.filled;
+
+    // below one arrival a second the cars are mostly idle; otherwise half of all trips starting or ending
+    // at the lobby is a peak
+    Traffic regime = rate < 1.0 ? Traffic::idle
+                   : lobbyOrigins >= 0.5 && up >= 0.5 ? Traffic::upPeak
+                   : lobbyDestinations >= 0.5 && up < 0.5 ? Traffic::downPeak
+                   : Traffic::interFloor;
+    if (regime == t.regime) {
+        return;
+    }
+    Policy policy = policy_for(regime);
+    Policy previous = b.policy.exchange(policy);
+    t.switches++;
+    ostringstream log;
+    log << "Traffic: " << traffic_name(t.regime) << " -> " << traffic_name(regime) << " after "
+         << b.peopleRead.load() << " people (last " << t.filled << ": " << 100 * lobbyOrigins << "% from lobby, "
+         << 100 * lobbyDestinations << "% to lobby, " << 100 * up << "% up, " << rate << " people/s), policy "
+         << policy_name(previous) << " -> " << policy_name(policy) << endl;
+    cout << log.str();
+    t.regime = regime;
+}
+
+void report_traffic(deque <Building>& buildings){
+    cout << "Traffic classifier:" << endl;
+    for (Building& b : buildings) {
+        TrafficClassifier& t = b.traffic;
+        lock_guard<mutex> lock(t.mtx);
+        cout << "  " << b.buildingFile << ": " << t.switches << " switches, now " << traffic_name(t.regime)
+             << " with policy " << policy_name(b.policy.load()) << ";";
+        for (int regime = 0; regime < 5; regime++) {
+            if (t.peopleIn[regime] > 0) {
+                cout << " " << traffic_name((Traffic)regime) << " " << t.peopleIn[regime];
+            }
+        }
+        cout << " people" << endl;
+    }
+}
+
+// count a person read by the reader. after the first few people every buffer and queue has grown to its
+// working size, so the allocation count from that point on is the steady state one
+void count_person_read(Building& b) {
+    if (++b.peopleRead == 10) {
+        b.warmAllocations = allocationCount.load();
+    }
+}
+
+// keeps up to depth /NextInput requests in flight at once (--prefetch). every slot has its own easy handle and
+// keep-alive connection (multiplexed on one connection when the simulator speaks HTTP/2). slots are handed
+// out in the same ring order their requests were sent in, so people reach the scheduler in send order even
+// when the answers come back out of order. that is not necessarily arrival order: a simulator that serves the
+// requests concurrently may answer request k+1 with an earlier person than request k, and nothing in the
+// answer says which came first
+class NextInputPrefetcher {
+public:
+    NextInputPrefetcher(const string& nextInputUrl, int depth) : url(nextInputUrl), slots(depth) {
+        multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)depth);
+        for (Slot& slot : slots) {
+            slot.curl = curl_easy_init();
+            curl_easy_setopt(slot.curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(slot.curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(slot.curl, CURLOPT_WRITEDATA, &slot.body);
+            curl_easy_setopt(slot.curl, CURLOPT_PRIVATE, &slot);
+            send(slot);
+        }
+    }
+
+    ~NextInputPrefetcher() {
+        for (Slot& slot : slots) {
+            if (!slot.done) {
+                curl_multi_remove_handle(multi, slot.curl);
+            }
+            curl_easy_cleanup(slot.curl);
+        }
+        curl_multi_cleanup(multi);
+    }
+
+    // body of the oldest request. the slot handed out last time is sent again first, so the returned
+    // reference stays valid until the next call
+    const string& next() {
+        if (handedOut) {
+            send(slots[head]);
+            head = (head + 1) % slots.size();
+        }
+        wait_for(slots[head]);
+        handedOut = true;
+        return slots[head].body;
+    }
+
+    // true when the next call to next() will not have to wait
+    bool ready() {
+        collect();
+        return slots[(head + (handedOut ? 1 : 0)) % slots.size()].done;
+    }
+
+    // wait for every request still in flight and return their bodies in order, without sending new ones
+    vector <string> finish() {
+        vector <string> bodies;
+        for (size_t n = handedOut ? 1 : 0; n < slots.size(); n++) {
+            Slot& slot = slots[(head + n) % slots.size()];
+            wait_for(slot);
+            bodies.push_back(slot.body);
+        }
+        return bodies;
+    }
+
+private:
+    struct Slot {
+        CURL* curl = nullptr;
+        string body;
+        bool done = true;
+    };
+
+    void send(Slot& slot) {
+        slot.body.clear();
+        slot.done = false;
+        curl_multi_add_handle(multi, slot.curl);
+    }
+
+    // move finished transfers out of the multi handle
+    void collect() {
+        int running, queued;
+        curl_multi_perform(multi, &running);
+        while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+            if (message->msg == CURLMSG_DONE) {
+                Slot* slot;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&slot);
+                count_async_result(slot->curl, inputEndpoint, message->data.result);
+                if (message->data.result != CURLE_OK) {
+                    std::cerr << "curl request failed: " << curl_easy_strerror(message->data.result) << std::endl;
+                    slot->body.clear();
+                }
+                curl_multi_remove_handle(multi, slot->curl);
+                slot->done = true;
+            }
+        }
+    }
+
+    // a prefetched request is parked on purpose, so its deadline counts from when the reader starts waiting
+    // for it, not from when it was sent
+    void wait_for(Slot& slot) {
+        collect();
+        long deadlineMs = httpPolicy.deadlineMs[inputEndpoint];
+        long long giveUpAt = now_ns() + deadlineMs * 1000000LL;
+        while (!slot.done) {
+            if (deadlineMs > 0 && now_ns() >= giveUpAt) {
+                curl_multi_remove_handle(multi, slot.curl);
+                count_async_result(slot.curl, inputEndpoint, CURLE_OPERATION_TIMEDOUT);
+                std::cerr << "curl request failed: " << curl_easy_strerror(CURLE_OPERATION_TIMEDOUT) << std::endl;
+                slot.body.clear();
+                slot.done = true;
+                break;
+            }
+            curl_multi_poll(multi, nullptr, 0, 100, nullptr);
+            collect();
+        }
+    }
+
+    string url;
+    CURLM* multi;
+    vector <Slot> slots;
+    size_t head = 0;
+    bool handedOut = false;
+};
+
+// called by every thread that adds people (the reader and the push listener) when it is done. the scheduler
+// only sees the end of input once all of them are
+void end_of_input(Building& b){
+    ProfiledLock lock(b.mtx, readerEndSite);
+    if (--b.inputSources == 0) {
+        // use a variable to indicate if the reader reached the end of file
+        b.endOfInput = true;
+        // then notify the worker threads
+        b.cv_scheduler.notify_all();
+    }
+}
+
+// --record-trace: one <seconds>|<personID>|<startFloor>|<endFloor>|<priority> line per person read, seconds
+// counted from the start of the recording. the reader and the push listener may both record
+void record_trace(Building& b, const Person& person){
+    if (!b.trace) {
+        return;
+    }
+    char line[64 + idSize];
+    snprintf(line, sizeof(line), "%.6f|%s|%d|%d|%d\n", (person.arrivalNs - b.traceStartNs) / 1e9, person.id,
+             person.startFloor, person.endFloor, person.priority);
+    lock_guard<mutex> lock(b.traceMtx);
+    *b.trace << line;
+}
+
+// parse one /NextInput answer and hand the person to the scheduler
+void enqueue_person(Building& b, const string& nextInput){
+    Person person;
+    if (parse_next_input(nextInput, person)) {
+        count_person_read(b);
+        observe_traffic(b, person);
+        record_trace(b, person);
+        speculate(b, person);
+        cout<<"Person:\n"<< person.id<<"\t"<< person.startFloor<<"\t"<< person.endFloor<<"\t";
+
+        // lock the shared queue people to make sure only one thread at a time can access it
+        ProfiledLock lock(b.mtx, readerPushSite);
+        b.people.push_back(person);
+        // when a person is pushed into shared people queue, notify the scheduler threads to wake up
+        b.cv_scheduler.notify_all();
+
+        cout<<"People:\n";
+        for(size_t i = 0; i < b.people.size(); i++){
+            cout<< b.people[i].id<<"\t"<< b.people[i].startFloor<<"\t"<< b.people[i].endFloor<<"\t";
+            cout<<endl;
+        }
+    }
+}
+
+void reader(Building& b){
+    unique_ptr<NextInputPrefetcher> prefetcher;
+    if (b.prefetchDepth > 1) {
+        prefetcher.reset(new NextInputPrefetcher(make_url(b.simulatorUrl, "/NextInput"), b.prefetchDepth));
+    }
+    auto nextInputRequest = [&b, &prefetcher]() -> const string& {
+        return prefetcher ? prefetcher->next() : b.transport->get("/NextInput");
+    };
+
+    const string* simulationStatus = &simulation_status(b);
+    bool running = *simulationStatus == "Simulation is running.";
+    cout<<"inside scheduler: "<<*simulationStatus <<endl;
+    while(running) {
+
+        const string* nextInput = &nextInputRequest();
+        cout<<"next input "<< *nextInput<<endl;
+
+        auto startTime = chrono::steady_clock::now();
+        // with prefetching the status is not checked after every person (that would cap the reader at one
+        // person per round trip again), so it is checked once when the simulator first runs dry instead
+        bool checkNow = prefetcher != nullptr;
+
+        // nextInput points into the transport's reused buffer, which the status check overwrites, so whether
+        // the simulator ran dry is kept here and only changes with a new /NextInput answer
+        bool idle = *nextInput == "NONE";
+        while(idle){
+            auto elapsedTime = chrono::steady_clock::now() - startTime;
+            if(checkNow || elapsedTime >= chrono::seconds(20)){
+                checkNow = false;
+
+                running = simulation_running(b);
+
+                if(!running){
+                    break;
+                }
+            }
+            // answers that are already waiting in the prefetcher are older than the NONE, no need to sleep
+            if (!prefetcher || !prefetcher->ready()) {
+                chrono::milliseconds duration(500); // 0.5 seconds
+                this_thread::sleep_for(duration);
+                cout<<"sleeping"<<endl;
+            }
+            // while a pusher is connected people arrive through the listener, polling would only add idle requests
+            if (b.pushClients > 0) {
+                continue;
+            }
+            nextInput = &nextInputRequest();
+            idle = *nextInput == "NONE";
+        }
+        if(!running){
+            break;
+        }
+
+        enqueue_person(b, *nextInput);
+
+        if (!prefetcher) {
+            simulationStatus = &simulation_status(b);
+            running = *simulationStatus == "Simulation is running.";
+            cout<<"READER: Simulation status: "<<*simulationStatus<<endl;
+        }
+
+    }
+    if (prefetcher) {
+        // people may still be in answers that were in flight when the simulation ended
+        for (const string& nextInput : prefetcher->finish()) {
+            if (nextInput != "NONE") {
+                enqueue_person(b, nextInput);
+            }
+        }
+    }
+    b.readerFinished = true;
+    end_of_input(b);
+}
+
+// optional push ingestion, enabled with --listen <port> (loopback TCP) or --listen unix:<path>.
+// a simulator or local adapter connects and writes records "personID|startFloor|endFloor", one per line, and
+// they go into the same people queue the reader fills. the reader keeps running as the fallback: while a
+// pusher is connected it stops polling /NextInput and only watches the simulation status
+int open_listener(const string& address) {
+    int fd;
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un local{};
+        local.sun_family = AF_UNIX;
+        string path = address.substr(5);
+        if (path.size() >= sizeof(local.sun_path)) {
+            cerr << "Socket path too long: " << path << endl;
+            return -1;
+        }
+        strcpy(local.sun_path, path.c_str());
+        unlink(path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::bind(fd, (sockaddr*)&local, sizeof(local)) != 0) {
+            cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+            return -1;
+        }
+    } else {
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_port = htons((uint16_t)atoi(address.c_str()));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (fd < 0 || ::bind(fd, (sockaddr*)&local, sizeof(local)) != 0) {
+            cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+            return -1;
+        }
+    }
+    listen(fd, 16);
+    return fd;
+}
+
+void listener(Building& b, int listenFd){
+    vector <pollfd> fds(1);
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    vector <string> pending(1);  // partial line per connection
+    string line;
+    char buffer[4096];
+
+    // stop once the reader has seen the simulation end, checking every 100 ms
+    while (!b.readerFinished) {
+        if (poll(fds.data(), fds.size(), 100) <= 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = accept(listenFd, nullptr, nullptr);
+            if (client >= 0) {
+                fds.push_back(pollfd{client, POLLIN, 0});
+                pending.emplace_back();
+                b.pushClients++;
+                cout << "LISTENER: pusher connected" << endl;
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t received = read(fds[i].fd, buffer, sizeof(buffer));
+            if (received <= 0) {
+                close(fds[i].fd);
+                fds.erase(fds.begin() + i);
+                pending.erase(pending.begin() + i);
+                i--;
+                b.pushClients--;
+                cout << "LISTENER: pusher disconnected, polling takes over" << endl;
+                continue;
+            }
+            pending[i].append(buffer, received);
+            size_t start = 0, newline;
+            while ((newline = pending[i].find('\n', start)) != string::npos) {
+                line.assign(pending[i], start, newline - start);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (!line.empty()) {
+                    enqueue_person(b, line);
+                }
+                start = newline + 1;
+            }
+            pending[i].erase(0, start);
+        }
+    }
+    for (size_t i = 1; i < fds.size(); i++) {
+        close(fds[i].fd);
+    }
+    close(listenFd);
+    end_of_input(b);
+}
+
+// --wait-stats: how long a person waited between being read and getting their assignment
+void record_wait(Building& b, const Person& person){
+    if (!b.waitStats) {
+        return;
+    }
+    long long waited = now_ns() - person.arrivalNs;
+    int bucket = 0;
+    while (bucket < 63 && (1LL << bucket) * 1000 < waited) {
+        bucket++;
+    }
+    b.waitBuckets[bucket]++;
+    b.waitCount++;
+    b.waitSumNs += waited;
+    atomic_max(b.waitMaxNs, waited);
+}
+
+// retry lane (--retry-unsatisfiable <tries>): a person whose trip no car can take right now is set aside
+// and decided again retryIntervalMs later instead of being assigned no car, so a burst of full cars does
+// not turn into empty assignments. after the last try they are assigned no car like before, which bounds
+// the extra wait to tries * retryIntervalMs
+const int retryIntervalMs = 20;
+
+bool retry_due(Building& b){
+    return !b.retryLane.empty() && b.retryLane.front().retryAtNs <= now_ns();
+}
+
+// bucket of a value in microseconds: values below kpiSubBuckets have a bucket each, above that the top
+// kpiSubBits + 1 bits of the value pick it
+int kpi_bucket(long long us){
+    if (us < kpiSubBuckets) {
+        return (int)max(0LL, us);
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long)us);
+    int octave = min(msb - kpiSubBits + 1, kpiOctaves - 1);
+    if (octave == kpiOctaves - 1 && msb > octave + kpiSubBits - 1) {
+        return kpiOctaves * kpiSubBuckets - 1;
+    }
+    return octave * kpiSubBuckets + (int)((us >> (msb - kpiSubBits)) & (kpiSubBuckets - 1));
+}
+
+// the largest value that falls into a bucket
+long long kpi_bucket_top(int bucket){
+    int octave = bucket / kpiSubBuckets;
+    int sub = bucket % kpiSubBuckets;
+    if (octave == 0) {
+        return sub;
+    }
+    return ((long long)(kpiSubBuckets + sub + 1) << (octave - 1)) - 1;
+}
+
+void kpi_record(KpiHistogram& histogram, long long us){
+    histogram.buckets[kpi_bucket(us)].fetch_add(1, memory_order_relaxed);
+    histogram.count.fetch_add(1, memory_order_relaxed);
+    histogram.sumUs.fetch_add(us, memory_order_relaxed);
+    atomic_max(histogram.maxUs, us);
+}
+
+// an upper bound of the quantile, never above the largest value seen
+long long kpi_quantile(const KpiHistogram& histogram, double quantile){
+    long long count = histogram.count.load();
+    long long seen = 0;
+    for (int bucket = 0; bucket < kpiOctaves * kpiSubBuckets; bucket++) {
+        seen += histogram.buckets[bucket].load(memory_order_relaxed);
+        if (seen > 0 && seen >= quantile * count) {
+            return min(kpi_bucket_top(bucket), histogram.maxUs.load());
+        }
+    }
+    return histogram.maxUs.load();
+}
+
+// --kpi: the PUT of an assignment was answered
+void record_kpi(Building& b, const Assignment& assignment){
+    PassengerKpis* kpi = b.kpi.get();
+    if (kpi == nullptr) {
+        return;
+    }
+    long long now = now_ns();
+    long long totalUs = (now - assignment.readNs) / 1000;
+    kpi_record(kpi->decide, (assignment.assignedNs - assignment.readNs) / 1000);
+    kpi_record(kpi->put, (now - assignment.assignedNs) / 1000);
+    kpi_record(kpi->total, totalUs);
+    kpi_record(kpi->direction[assignment.endFloor < assignment.startFloor], totalUs);
+    size_t floor = (size_t)(assignment.startFloor - kpi->lowestFloor);
+    if (assignment.startFloor >= kpi->lowestFloor && floor < kpi->floorCount) {
+        kpi_record(kpi->floors[floor], totalUs);
+    }
+    long long row = elevator_row(b, assignment.elevatorId);
+    if (row >= 0 && (size_t)row < kpi->carCount) {
+        kpi_record(kpi->byCar[row], totalUs);
+    } else {
+        kpi->noCar++;
+    }
+}
+
+void init_kpi(Building& b){
+    int lowest = INT_MAX;
+    int highest = INT_MIN;
+    for (const Elevator& elevator : b.elevators) {
+        lowest = min(lowest, elevator.lowestFloor);
+        highest = max(highest, elevator.highestFloor);
+    }
+    if (b.elevators.empty()) {
+        lowest = highest = 0;
+    }
+    b.kpi.reset(new PassengerKpis(b.elevators.size(), lowest, highest));
+    b.kpi->startNs = now_ns();
+}
+
+void print_kpi(const string& label, const KpiHistogram& histogram){
+    long long count = histogram.count.load();
+    cout << "    " << label << ": " << count << " people";
+    if (count > 0) {
+        cout << ", mean " << histogram.sumUs.load() / 1000.0 / count << " ms";
+        const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        for (double quantile : quantiles) {
+            cout << ", p" << quantile * 100 << " " << kpi_quantile(histogram, quantile) / 1000.0 << " ms";
+        }
+        cout << ", max " << histogram.maxUs.load() / 1000.0 << " ms";
+    }
+    cout << endl;
+}
+
+// a breakdown table, the rows with the worst p99 first. a large building only shows the first kpiRowsShown
+const size_t kpiRowsShown = 20;
+
+void print_kpi_rows(const char* title, const vector <pair<string, const KpiHistogram*>>& rows, double seconds){
+    vector <pair<long long, size_t>> order;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (rows[i].second->count.load() > 0) {
+            order.emplace_back(-kpi_quantile(*rows[i].second, 0.99), i);
+        }
+    }
+    sort(order.begin(), order.end());
+    cout << "  " << title << " (" << order.size() << " with people, worst p99 first):" << endl;
+    for (size_t n = 0; n < order.size() && n < kpiRowsShown; n++) {
+        const pair<string, const KpiHistogram*>& row = rows[order[n].second];
+        print_kpi(row.first, *row.second);
+        if (seconds > 0) {
+            cout << "      " << row.second->count.load() * 60 / seconds << " people/min" << endl;
+        }
+    }
+    if (order.size() > kpiRowsShown) {
+        cout << "    ... " << order.size() - kpiRowsShown << " more" << endl;
+    }
+}
+
+void report_kpi(deque <Building>& buildings){
+    cout << "Passenger KPIs:" << endl;
+    for (Building& b : buildings) {
+        PassengerKpis& kpi = *b.kpi;
+        double seconds = (now_ns() - kpi.startNs) / 1e9;
+        cout << "  " << b.buildingFile << ": " << kpi.noCar << " people assigned no car, "
+             << (kpi.floorCount + kpi.carCount + 5) * sizeof(KpiHistogram) / 1024 << " KiB of histograms" << endl;
+        print_kpi("read to decided", kpi.decide);
+        print_kpi("decided to PUT answered", kpi.put);
+        print_kpi("read to PUT answered", kpi.total);
+        print_kpi("going up", kpi.direction[0]);
+        print_kpi("going down", kpi.direction[1]);
+        vector <pair<string, const KpiHistogram*>> rows;
+        for (size_t floor = 0; floor < kpi.floorCount; floor++) {
+            rows.emplace_back("floor " + to_string(kpi.lowestFloor + (int)floor), &kpi.floors[floor]);
+        }
+        print_kpi_rows("read to PUT answered by start floor", rows, 0);
+        rows.clear();
+        for (size_t car = 0; car < kpi.carCount; car++) {
+            rows.emplace_back(string("car ") + b.elevators[car].bayId, &kpi.byCar[car]);
+        }
+        print_kpi_rows("read to PUT answered and assignment rate by car", rows, seconds);
+    }
+}
+
+void report_waiting(deque <Building>& buildings){
+    cout << "Waiting queue:" << endl;
+    for (Building& b : buildings) {
+        long long count = b.waitCount.load();
+        cout << "  " << b.buildingFile << ": " << b.emptyDecisions << " decisions found no car ("
+             << b.emptyDecisionNs / 1000000.0 << " ms of head-of-line time), " << b.retriedPeople << " retries, "
+             << b.gaveUpPeople << " people assigned no car after " << b.maxRetries << " retries" << endl;
+        if (count == 0) {
+            continue;
+        }
+        cout << "    wait from read to assignment: mean " << b.waitSumNs.load() / 1000.0 / count << " us";
+        const double percentiles[] = {0.5, 0.9, 0.99};
+        for (double percentile : percentiles) {
+            long long seen = 0;
+            int bucket = 0;
+            while (bucket < 63 && (seen += b.waitBuckets[bucket].load()) < percentile * count) {
+                bucket++;
+            }
+            cout << ", p" << percentile * 100 << " <= " << (1LL << bucket) << " us";
+        }
+        cout << ", max " << b.waitMaxNs.load() / 1000.0 << " us over " << count << " people" << endl;
+    }
+}
+
+void schedule_elevator(Building& b){
+    while(true){
+        // lock the shared resources to make sure only one thread at a time accesses them
+        ProfiledLock lock(b.mtx, schedulerSite);
+        // wait if the shared buffer is empty and the reader has not reached the end of file yet, or until the
+        // first person in the retry lane is due
+        auto ready = [&b] { return !b.people.empty() || retry_due(b) || (b.endOfInput && b.retryLane.empty()); };
+        if (b.retryLane.empty()) {
+            lock.wait(b.cv_scheduler, ready);
+        } else if (!lock.wait_until(b.cv_scheduler, b.retryLane.front().retryAtNs, ready)) {
+            continue;
+        }
+
+        if(b.endOfInput == true && b.people.empty() && b.retryLane.empty()){
+            break;
+        }
+        Person personWaitingElevator;
+        if (retry_due(b) || b.people.empty()) {
+            personWaitingElevator = b.retryLane.front();
+            b.retryLane.pop_front();
+        } else {
+            personWaitingElevator = b.people.front();
+            b.people.pop_front();
+        }
+
+        int startFloor = personWaitingElevator.startFloor;
+        int endFloor = personWaitingElevator.endFloor;
+
+        string needUpOrDown;
+        if (endFloor - startFloor >= 0) {
+            needUpOrDown = "U";
+        } else {
+            needUpOrDown = "D";
+        }
+        cout<<"after parsing next person"<<endl;
+
+        long long decisionStart = now_ns();
+        Assignment nextPerson = decide_elevator(b, personWaitingElevator);
+        if (nextPerson.elevatorId[0] == '\0') {
+            b.emptyDecisions++;
+            b.emptyDecisionNs += now_ns() - decisionStart;
+            if (personWaitingElevator.retries < b.maxRetries) {
+                personWaitingElevator.retries++;
+                personWaitingElevator.retryAtNs = now_ns() + retryIntervalMs * 1000000LL;
+                b.retryLane.push_back(personWaitingElevator);
+                b.retriedPeople++;
+                continue;
+            }
+            if (b.maxRetries > 0) {
+                b.gaveUpPeople++;
+            }
+        }
+        record_wait(b, personWaitingElevator);
+        assignment_decided(b, nextPerson);
+
+        cout<<"next person with elevator assigned: "<<nextPerson.personId<<"/"<<nextPerson.elevatorId<<endl;
+    }
+    ProfiledLock lock(b.mtx, schedulerEndSite);
+    // use a variable to indicate if the reader reached the end of file, then notify the worker threads
+    scheduling_done(b);
+}
+
+
+// a router or zone scheduler thread is done; the last one lets the assigner finish
+void zone_thread_done(Building& b){
+    if (--b.zoneThreads == 0) {
+        ProfiledLock lock(b.mtx, schedulerEndSite);
+        scheduling_done(b);
+    }
+}
+
+// with --zones the scheduler thread becomes a router: it only hands each person to the queue of their bank.
+// a trip no bank covers is assigned no elevator right away, like pick_elevator finding no car
+void route_people(Building& b){
+    while (true) {
+        Person personWaitingElevator;
+        {
+            ProfiledLock lock(b.mtx, schedulerSite);
+            lock.wait(b.cv_scheduler, [&b] { return !b.people.empty() || b.endOfInput; });
+            if (b.endOfInput && b.people.empty()) {
+                break;
+            }
+            personWaitingElevator = b.people.front();
+            b.people.pop_front();
+            Zone* zone = route_zone(b, personWaitingElevator.startFloor, personWaitingElevator.endFloor);
+            if (zone == nullptr) {
+                record_wait(b, personWaitingElevator);
+                assignment_decided(b, make_assignment(personWaitingElevator, nullptr));
+                continue;
+            }
+            lock_guard<mutex> zoneLock(zone->mtx);
+            zone->people.push_back(personWaitingElevator);
+            zone->cv.notify_one();
+        }
+    }
+    for (Zone& zone : b.zones) {
+        lock_guard<mutex> zoneLock(zone.mtx);
+        zone.endOfInput = true;
+        zone.cv.notify_one();
+    }
+    zone_thread_done(b);
+}
+
+// scheduler of one bank: decides for the people of its bank with only the bank's cars, without holding the
+// building lock, so the banks are decided in parallel
+void schedule_zone(Building& b, Zone& zone){
+    while (true) {
+        Person personWaitingElevator;
+        {
+            ProfiledLock lock(zone.mtx, zoneSite);
+            lock.wait(zone.cv, [&zone] { return !zone.people.empty() || zone.endOfInput; });
+            if (zone.endOfInput && zone.people.empty()) {
+                break;
+            }
+            personWaitingElevator = zone.people.front();
+            zone.people.pop_front();
+        }
+        Assignment nextPerson = decide_elevator(b, personWaitingElevator, &zone);
+        if (!b.checkpointPath.empty() && b.statusRefreshMs == 0) {
+            ProfiledLock lock(zone.mtx, zoneSite);
+            for (size_t n = 0; n < zone.cars.size(); n++) {
+                zone.checkpointCars[n] = b.elevators[zone.cars[n]];
+            }
+        }
+        record_wait(b, personWaitingElevator);
+        zone.decisions++;
+        cout << "zone " << zone.lowestFloor << "-" << zone.highestFloor << ": next person with elevator assigned: "
+             << nextPerson.personId << "/" << nextPerson.elevatorId << endl;
+        ProfiledLock lock(b.mtx, schedulerSite);
+        assignment_decided(b, nextPerson);
+    }
+    zone_thread_done(b);
+}
+
+void report_reservations(deque <Building>& buildings){
+    cout << "Reservation ledger:" << endl;
+    for (Building& b : buildings) {
+        long long refreshes = b.ledgerRefreshes.load();
+        long long skipped = b.ledgerSkippedRefreshes.load();
+        long long inFlight = 0, unsettled = 0;
+        for (size_t i = 0; i < b.elevators.size(); i++) {
+            inFlight += b.ledger->inFlight[i].load();
+            unsettled += b.ledger->unsettled[i].load();
+        }
+        cout << "  " << b.buildingFile << ": ";
+        if (refreshes + skipped > 0) {
+            cout << skipped << "/" << refreshes + skipped << " decisions made without fetching status, ";
+        }
+        cout << inFlight << " reservations in flight and " << unsettled << " unsettled at shutdown" << endl;
+    }
+}
+
+void report_zones(deque <Building>& buildings){
+    cout << "Zones:" << endl;
+    for (Building& b : buildings) {
+        cout << "  " << b.buildingFile << ": " << b.zones.size() << " zones" << endl;
+        for (const Zone& zone : b.zones) {
+            if (zone.decisions > 0) {
+                cout << "    floors " << zone.lowestFloor << "-" << zone.highestFloor << ": " << zone.cars.size()
+                     << " cars, " << zone.decisions << " people" << endl;
+            }
+        }
+    }
+}
+
+void add_person_to_elevator(Building& b){
+    while(true){
+        // lock the shared resources to make sure only one thread at a time accesses them
+        ProfiledLock lock(b.mtx, assignerSite);
+        // wait if the shared buffer is empty and the reader has not reached the end of file yet
+        lock.wait(b.cv_addToElevator, [&b] { return !b.assignedElevator.empty() || b.everyoneAssignedElevator; });
+
+        if(b.everyoneAssignedElevator == true && b.assignedElevator.empty()){
+            break;
+        }
+
+        Assignment& nextPerson = b.assignedElevator.front();
+        late_bind(b, nextPerson);
+        b.transport->put("/AddPersonToElevator/", nextPerson.personId, nextPerson.elevatorId);
+        car_put(b, nextPerson);
+        record_kpi(b, nextPerson);
+        b.assignedElevator.pop_front();
+    }
+
+}
+
+// one worker of the assigner pool. nothing here takes b.mtx: the PUT and the ledger update only touch the
+// worker's own connection and atomics. late binding already ran in hand_to_assigner
+void assigner_worker(Building& b, AssignerShard& shard){
+    Assignment nextPerson;
+    while (true) {
+        // read before the pop: once finished is set every assignment has been pushed, so an empty queue is final
+        bool finished = shard.finished.load();
+        if (shard.queue.try_pop(nextPerson)) {
+            b.transport->put("/AddPersonToElevator/", nextPerson.personId, nextPerson.elevatorId);
+            car_put(b, nextPerson);
+            record_kpi(b, nextPerson);
+            shard.puts++;
+        } else if (finished) {
+            break;
+        } else {
+            shard.park();
+        }
+    }
+}
+
+void report_assigners(deque <Building>& buildings){
+    cout << "Assigner pool:" << endl;
+    for (Building& b : buildings) {
+        cout << "  " << b.buildingFile << ":";
+        for (size_t i = 0; i < b.assignerShards.size(); i++) {
+            cout << (i ? ", " : " ") << "worker " << i << " " << b.assignerShards[i].puts << " PUTs";
+        }
+        cout << endl;
+    }
+}
+
+// single threaded alternative to the reader/scheduler/assigner threads, enabled with --event-loop.
+// every HTTP call goes through one curl multi handle driven by epoll, so instead of three threads that sit
+// in curl_easy_perform or sleep_for, the three stages are callbacks that run when a request completes or a
+// timer fires. any number of requests can be outstanding at once on a single core.
+struct AsyncRequest {
+    CURL* curl;
+    string url;
+    string body;
+    function<void(const string&)> done;
+    HttpEndpoint endpoint;
+};
+
+struct EventLoop {
+    CURLM* multi = nullptr;
+    int epollFd = -1;
+    long long curlDeadline = -1;  // when curl wants curl_multi_socket_action(CURL_SOCKET_TIMEOUT), -1 for never
+    int transfers = 0;
+    multimap<long long, function<void()>> timers;  // deadline in ns -> callback
+    // the header every PUT carries, shared by all the loop's PUT handles
+    curl_slist* putHeaders = curl_slist_append(nullptr, "Content-Type: application/json");
+
+    // pipeline state, only ever touched from the loop thread so it needs no locking
+    Building* building = nullptr;
+    bool readerDone = false;
+    bool scheduling = false;
+    int putsInFlight = 0;
+    long long idleSince = -1;
+};
+
+int loop_socket_callback(CURL*, curl_socket_t socket, int what, void* userp, void*) {
+    EventLoop* loop = (EventLoop*)userp;
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, socket, nullptr);
+        return 0;
+    }
+    epoll_event event{};
+    event.data.fd = socket;
+    event.events = ((what & CURL_POLL_IN) ? (uint32_t)EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? (uint32_t)EPOLLOUT : 0);
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, socket, &event) != 0) {
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, socket, &event);
+    }
+    return 0;
+}
+
+int loop_timer_callback(CURLM*, long timeoutMs, void* userp) {
+    EventLoop* loop = (EventLoop*)userp;
+    loop->curlDeadline = timeoutMs < 0 ? -1 : now_ns() + timeoutMs * 1000000LL;
+    return 0;
+}
+
+void loop_request(EventLoop& loop, const string& url, bool put, function<void(const string&)> done) {
+    HttpEndpoint endpoint = put ? putEndpoint : endpoint_of(url.c_str() + loop.building->simulatorUrl.size());
+    AsyncRequest* request = new AsyncRequest{curl_easy_init(), url, "", done, endpoint};
+    curl_easy_setopt(request->curl, CURLOPT_URL, request->url.c_str());
+    curl_easy_setopt(request->curl, CURLOPT_TIMEOUT_MS, httpPolicy.deadlineMs[endpoint]);
+    curl_easy_setopt(request->curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(request->curl, CURLOPT_WRITEDATA, &request->body);
+    curl_easy_setopt(request->curl, CURLOPT_PRIVATE, request);
+    if (put) {
+        curl_easy_setopt(request->curl, CURLOPT_CUSTOMREQUEST, "PUT");
+        curl_easy_setopt(request->curl, CURLOPT_HTTPHEADER, loop.putHeaders);
+    }
+    curl_multi_add_handle(loop.multi, request->curl);
+    loop.transfers++;
+}
+
+void loop_get(EventLoop& loop, const string& url, function<void(const string&)> done) {
+    loop_request(loop, url, false, done);
+}
+
+void loop_put(EventLoop& loop, const string& url, function<void(const string&)> done) {
+    loop_request(loop, url, true, done);
+}
+
+void loop_after(EventLoop& loop, chrono::milliseconds delay, function<void()> callback) {
+    loop.timers.emplace(now_ns() + chrono::duration_cast<chrono::nanoseconds>(delay).count(), callback);
+}
+
+// hand finished transfers to their callbacks
+void loop_complete_transfers(EventLoop& loop) {
+    int queued;
+    while (CURLMsg* message = curl_multi_info_read(loop.multi, &queued)) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+        AsyncRequest* request;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&request);
+        count_async_result(request->curl, request->endpoint, message->data.result);
+        if (message->data.result != CURLE_OK) {
+            std::cerr << "curl request failed: " << curl_easy_strerror(message->data.result) << std::endl;
+            request->body.clear();
+        }
+        curl_multi_remove_handle(loop.multi, request->curl);
+        curl_easy_cleanup(request->curl);
+        loop.transfers--;
+        request->done(request->body);
+        delete request;
+    }
+}
+
+void loop_run(EventLoop& loop, function<bool()> finished) {
+    epoll_event events[64];
+    int running;
+    while (!finished()) {
+        long long now = now_ns();
+        long long deadline = loop.curlDeadline;
+        if (!loop.timers.empty() && (deadline < 0 || loop.timers.begin()->first < deadline)) {
+            deadline = loop.timers.begin()->first;
+        }
+        if (deadline < 0 && loop.transfers == 0) {
+            cerr << "event loop has nothing left to wait for" << endl;
+            break;
+        }
+        int waitMs = deadline < 0 ? -1 : (int)max(0LL, (deadline - now + 999999) / 1000000);
+        int ready = epoll_wait(loop.epollFd, events, 64, waitMs);
+        for (int i = 0; i < ready; i++) {
+            int flags = ((events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+                        ((events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                        ((events[i].events & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0);
+            curl_multi_socket_action(loop.multi, events[i].data.fd, flags, &running);
+        }
+        if (loop.curlDeadline >= 0 && now_ns() >= loop.curlDeadline) {
+            loop.curlDeadline = -1;
+            curl_multi_socket_action(loop.multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        loop_complete_transfers(loop);
+        while (!loop.timers.empty() && loop.timers.begin()->first <= now_ns()) {
+            function<void()> callback = loop.timers.begin()->second;
+            loop.timers.erase(loop.timers.begin());
+            callback();
+        }
+    }
+}
+
+void loop_assign(EventLoop& loop);
+void loop_schedule_next(EventLoop& loop);
+void loop_next_input(EventLoop& loop);
+
+// reader stage: check the simulation, then keep asking for the next person
+void loop_check_status(EventLoop& loop) {
+    loop_get(loop, loop.building->simulatorUrl + "/Simulation/check", [&loop](const string& simulationStatus) {
+        cout << "READER: Simulation status: " << simulationStatus << endl;
+        if (simulationStatus == "Simulation is running.") {
+            loop_next_input(loop);
+        } else {
+            loop.readerDone = true;
+        }
+    });
+}
+
+void loop_next_input(EventLoop& loop) {
+    loop_get(loop, loop.building->simulatorUrl + "/NextInput", [&loop](const string& nextInput) {
+        cout << "next input " << nextInput << endl;
+        if (nextInput == "NONE") {
+            if (loop.idleSince < 0) {
+                loop.idleSince = now_ns();
+            }
+            // same pacing as the reader thread: poll every 0.5 s and recheck the simulation after 20 s idle
+            loop_after(loop, chrono::milliseconds(500), [&loop] {
+                if (now_ns() - loop.idleSince >= 20000000000LL) {
+                    loop_check_status(loop);
+                } else {
+                    loop_next_input(loop);
+                }
+            });
+            return;
+        }
+        loop.idleSince = -1;
+        Person person;
+        if (parse_next_input(nextInput, person)) {
+            count_person_read(*loop.building);
+            observe_traffic(*loop.building, person);
+            record_trace(*loop.building, person);
+            loop.building->people.push_back(person);
+        }
+        loop_schedule_next(loop);
+        loop_check_status(loop);
+    });
+}
+
+// scheduler stage: one decision at a time so people are assigned in arrival order,
+// but the status of every car is requested in parallel
+void loop_schedule_next(EventLoop& loop) {
+    Building& b = *loop.building;
+    if (loop.scheduling || b.people.empty()) {
+        return;
+    }
+    loop.scheduling = true;
+    shared_ptr<size_t> remaining = make_shared<size_t>(b.elevators.size());
+    auto decide = [&loop, &b] {
+        Person personWaitingElevator = b.people.front();
+        b.people.pop_front();
+        Assignment nextPerson = make_assignment(personWaitingElevator,
+            pick_routed(b, b.elevators, personWaitingElevator.startFloor, personWaitingElevator.endFloor));
+        record_wait(b, personWaitingElevator);
+        cout << "next person with elevator assigned: " << nextPerson.personId << "/" << nextPerson.elevatorId << endl;
+        b.assignedElevator.push_back(nextPerson);
+        loop.scheduling = false;
+        loop_assign(loop);
+        loop_schedule_next(loop);
+    };
+    if (b.elevators.empty()) {
+        decide();
+        return;
+    }
+    if (b.bulkStatus) {
+        loop_get(loop, make_url(b.simulatorUrl, "/ElevatorStatus/all"), [&b, decide](const string& statusLines) {
+            apply_bulk_status(b, b.elevators, statusLines);
+            decide();
+        });
+        return;
+    }
+    for (size_t i = 0; i < b.elevators.size(); i++) {
+        loop_get(loop, make_url(b.simulatorUrl, "/ElevatorStatus/", b.elevators[i].bayId),
+                 [&b, i, remaining, decide](const string& elevatorStatus) {
+            update_elevator_status(b.elevators, i, elevatorStatus.c_str());
+            if (--*remaining == 0) {
+                decide();
+            }
+        });
+    }
+}
+
+// assigner stage: every assignment goes out right away, no need to wait for the previous PUT
+void loop_assign(EventLoop& loop) {
+    Building& b = *loop.building;
+    while (!b.assignedElevator.empty()) {
+        loop.putsInFlight++;
+        Assignment& nextPerson = b.assignedElevator.front();
+        loop_put(loop, make_url(b.simulatorUrl, "/AddPersonToElevator/", nextPerson.personId, nextPerson.elevatorId),
+                 [&loop, &b, nextPerson](const string&) {
+                     loop.putsInFlight--;
+                     record_kpi(b, nextPerson);
+                 });
+        b.assignedElevator.pop_front();
+    }
+}
+
+void run_event_loop(Building& b) {
+    EventLoop loop;
+    loop.building = &b;
+    loop.multi = curl_multi_init();
+    loop.epollFd = epoll_create1(0);
+    curl_multi_setopt(loop.multi, CURLMOPT_SOCKETFUNCTION, loop_socket_callback);
+    curl_multi_setopt(loop.multi, CURLMOPT_SOCKETDATA, &loop);
+    curl_multi_setopt(loop.multi, CURLMOPT_TIMERFUNCTION, loop_timer_callback);
+    curl_multi_setopt(loop.multi, CURLMOPT_TIMERDATA, &loop);
+
+    loop_check_status(loop);
+    loop_run(loop, [&loop, &b] {
+        return loop.readerDone && b.people.empty() && !loop.scheduling && loop.putsInFlight == 0;
+    });
+
+    curl_multi_cleanup(loop.multi);
+    curl_slist_free_all(loop.putHeaders);
+    close(loop.epollFd);
+}
+
+// work stealing thread pool for running many buildings in one process (--pool).
+// every worker owns a deque of tasks: it pushes and pops new work at the back of its own deque and, when that
+// is empty, steals from the front of another worker's deque. tasks that must wait (the reader's 0.5 s poll)
+// sit in a shared timer list until they are due instead of blocking a worker in sleep_for.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t threadCount) {
+        for (size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back(new Worker);
+        }
+        for (size_t i = 0; i < threadCount; i++) {
+            threads.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(sleepMtx);
+            stopping = true;
+        }
+        sleepCv.notify_all();
+        for (thread& worker : threads) {
+            worker.join();
+        }
+    }
+
+    void submit(function<void()> task) {
+        outstanding++;
+        // tasks submitted from a worker stay on that worker, the rest are spread round robin
+        size_t target = currentWorker < workers.size() ? currentWorker : nextWorker++ % workers.size();
+        {
+            lock_guard<mutex> lock(workers[target]->mtx);
+            workers[target]->tasks.push_back(move(task));
+        }
+        queued++;
+        lock_guard<mutex> lock(sleepMtx);
+        sleepCv.notify_one();
+    }
+
+    void submit_after(chrono::milliseconds delay, function<void()> task) {
+        outstanding++;
+        lock_guard<mutex> lock(sleepMtx);
+        timers.emplace(now_ns() + chrono::duration_cast<chrono::nanoseconds>(delay).count(), move(task));
+        sleepCv.notify_one();
+    }
+
+    // block until every task, including the ones they submitted, has finished
+    void wait_until_idle() {
+        unique_lock<mutex> lock(sleepMtx);
+        idleCv.wait(lock, [this] { return outstanding == 0; });
+    }
+
+private:
+    struct Worker {
+        mutex mtx;
+        deque<function<void()>> tasks;
+    };
+
+    bool try_pop(size_t self, function<void()>& task) {
+        for (size_t n = 0; n < workers.size(); n++) {
+            Worker& victim = *workers[(self + n) % workers.size()];
+            lock_guard<mutex> lock(victim.mtx);
+            if (!victim.tasks.empty()) {
+                if (n == 0) {
+                    task = move(victim.tasks.back());
+                    victim.tasks.pop_back();
+                } else {
+                    task = move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                }
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        currentWorker = self;
+        function<void()> task;
+        while (true) {
+            if (try_pop(self, task)) {
+                task();
+                task = nullptr;
+                if (--outstanding == 0) {
+                    lock_guard<mutex> lock(sleepMtx);
+                    idleCv.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> lock(sleepMtx);
+            if (!timers.empty() && timers.begin()->first <= now_ns()) {
+                // a due timer becomes an ordinary task on this worker
+                function<void()> due = move(timers.begin()->second);
+                timers.erase(timers.begin());
+                lock.unlock();
+                lock_guard<mutex> own(workers[self]->mtx);
+                workers[self]->tasks.push_back(move(due));
+                queued++;
+                continue;
+            }
+            if (stopping) {
+                break;
+            }
+            if (queued > 0) {
+                continue;
+            }
+            if (timers.empty()) {
+                sleepCv.wait(lock);
+            } else {
+                sleepCv.wait_for(lock, chrono::nanoseconds(timers.begin()->first - now_ns()));
+            }
+        }
+    }
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    mutex sleepMtx;
+    condition_variable sleepCv;
+    condition_variable idleCv;
+    multimap<long long, function<void()>> timers;  // guarded by sleepMtx
+    atomic<long long> outstanding{0};  // queued, running and timer tasks
+    atomic<long long> queued{0};       // tasks sitting in a worker deque
+    atomic<size_t> nextWorker{0};
+    bool stopping = false;
+    static thread_local size_t currentWorker;
+};
+
+thread_local size_t WorkStealingPool::currentWorker = SIZE_MAX;
+
+// run a building stage on the pool so that at most one copy of it is running at any time, which keeps the
+// scheduler and assigner of a building in order just like their dedicated threads. every signal after the
+// first one makes the running copy drain once more instead of starting a second copy
+void signal_stage(WorkStealingPool& pool, atomic<int>& signals, function<void()> drain) {
+    if (signals.fetch_add(1) == 0) {
+        pool.submit([&signals, drain] {
+            int seen = signals.load();
+            do {
+                drain();
+            } while (!signals.compare_exchange_strong(seen, 0));
+        });
+    }
+}
+
+void pool_assign(WorkStealingPool& pool, Building& b) {
+    signal_stage(pool, b.assignerSignals, [&b] {
+        while (true) {
+            Assignment nextPerson;
+            {
+                ProfiledLock lock(b.mtx, assignerSite);
+                if (b.assignedElevator.empty()) {
+                    return;
+                }
+                nextPerson = b.assignedElevator.front();
+                b.assignedElevator.pop_front();
+            }
+            late_bind(b, nextPerson);
+            b.transport->put("/AddPersonToElevator/", nextPerson.personId, nextPerson.elevatorId);
+            car_put(b, nextPerson);
+            record_kpi(b, nextPerson);
+        }
+    });
+}
+
+void pool_schedule(WorkStealingPool& pool, Building& b) {
+    signal_stage(pool, b.schedulerSignals, [&pool, &b] {
+        while (true) {
+            Person personWaitingElevator;
+            {
+                ProfiledLock lock(b.mtx, schedulerSite);
+                if (b.people.empty()) {
+                    if (b.endOfInput) {
+                        b.everyoneAssignedElevator = true;
+                    }
+                    return;
+                }
+                personWaitingElevator = b.people.front();
+                b.people.pop_front();
+            }
+            // only this task touches the elevator table of the building, so the HTTP calls run unlocked
+            Assignment nextPerson = decide_elevator(b, personWaitingElevator);
+            record_wait(b, personWaitingElevator);
+            cout << b.buildingFile << ": next person with elevator assigned: "
+                 << nextPerson.personId << "/" << nextPerson.elevatorId << endl;
+            {
+                ProfiledLock lock(b.mtx, schedulerSite);
+                b.assignedElevator.push_back(nextPerson);
+            }
+            pool_assign(pool, b);
+        }
+    });
+}
+
+void pool_end_of_input(WorkStealingPool& pool, Building& b) {
+    {
+        ProfiledLock lock(b.mtx, readerEndSite);
+        b.endOfInput = true;
+    }
+    pool_schedule(pool, b);
+}
+
+// reader stage: one /NextInput per task. a NONE answer reschedules the task 0.5 s later instead of sleeping
+void pool_read(WorkStealingPool& pool, Building& b) {
+    const string& nextInput = b.transport->get("/NextInput");
+    if (nextInput == "NONE") {
+        if (b.idleSince < 0) {
+            b.idleSince = now_ns();
+        }
+        if (now_ns() - b.idleSince >= 20000000000LL && !simulation_running(b)) {
+            pool_end_of_input(pool, b);
+            return;
+        }
+        pool.submit_after(chrono::milliseconds(500), [&pool, &b] { pool_read(pool, b); });
+        return;
+    }
+    b.idleSince = -1;
+    Person person;
+    if (parse_next_input(nextInput, person)) {
+        count_person_read(b);
+        observe_traffic(b, person);
+        record_trace(b, person);
+        speculate(b, person);
+        ProfiledLock lock(b.mtx, readerPushSite);
+        b.people.push_back(person);
+    }
+    pool_schedule(pool, b);
+
+    if (!simulation_running(b)) {
+        pool_end_of_input(pool, b);
+        return;
+    }
+    pool.submit([&pool, &b] { pool_read(pool, b); });
+}
+
+// refresher for a building in the pool: one refresh per task, repeated every statusRefreshMs until the building is done
+void pool_refresh(WorkStealingPool& pool, Building& b, shared_ptr<vector <Elevator>> elevators) {
+    {
+        ProfiledLock lock(b.mtx, schedulerEndSite);
+        if (b.everyoneAssignedElevator) {
+            return;
+        }
+    }
+    thread_local vector <int> captured;
+    capture_unsettled(b, captured);
+    refresh_elevator_status(b, *elevators);
+    publish_snapshot(b, *elevators);
+    settle_reservations(b, captured);
+    pool.submit_after(chrono::milliseconds(b.statusRefreshMs), [&pool, &b, elevators] { pool_refresh(pool, b, elevators); });
+}
+
+void run_pool(deque <Building>& buildings) {
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    cout << "Running " << buildings.size() << " buildings on " << threadCount << " worker threads" << endl;
+    WorkStealingPool pool(threadCount);
+    for (Building& b : buildings) {
+        pool.submit([&pool, &b] {
+            b.transport->put("/Simulation/start");
+            if (b.statusRefreshMs > 0) {
+                pool_refresh(pool, b, make_shared<vector <Elevator>>(b.elevators));
+            }
+            if (simulation_running(b)) {
+                pool_read(pool, b);
+            } else {
+                pool_end_of_input(pool, b);
+            }
+        });
+    }
+    pool.wait_until_idle();
+}
+
+// read a tab separated building file into an elevator table
+bool load_text_building(const string& path, vector <Elevator>& elevators) {
+    // Open the file
+    ifstream file(path);
+    if (!file.is_open()) {
+        cerr << "Error opening file " << path << endl;
+        return false;
+    }
+
+    string line;
+    while (getline(file, line)) {
+        istringstream iss(line);
+        string bayID;
+
+        // bayID, lowest floor, highest floor, current floor and capacity separated by tabs
+        Elevator elevator;
+        if (!getline(iss, bayID, '\t') ||
+            !(iss >> elevator.lowestFloor >> elevator.highestFloor >> elevator.currentFloor >> elevator.remainingCapacity)) {
+            if (!line.empty()) {
+                cerr << "Skipping malformed building line: " << line << endl;
+            }
+            continue;
+        }
+        copy_id(elevator.bayId, bayID.data(), bayID.data() + bayID.size());
+
+        // Push the current elevator to elevators
+        elevators.push_back(elevator);
+    }
+
+    // Close the file
+    file.close();
+    return true;
+}
+
+// compiled building file: a header followed by the elevator table exactly as it sits in memory, so loading
+// it is one mmap and one copy no matter how many cars the building has. made with --compile-building
+const char binaryBuildingMagic[4] = {'E', 'L', 'V', 'B'};
+const uint32_t binaryBuildingVersion = 1;
+
+struct BinaryBuildingHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t elevatorCount;
+    uint32_t recordSize;
+};
+
+static_assert(is_trivially_copyable<Elevator>::value, "Elevator rows are written to disk as raw bytes");
+static_assert(sizeof(Elevator) == idSize + 4 * sizeof(int32_t), "Elevator rows must not contain padding");
+
+// check the header and every row of a mapped building file before any of it is used
+bool validate_binary_building(const char* data, size_t size, const string& path) {
+    if (size < sizeof(BinaryBuildingHeader)) {
+        cerr << path << ": too small for a building header" << endl;
+        return false;
+    }
+    BinaryBuildingHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != binaryBuildingVersion || header.recordSize != sizeof(Elevator)) {
+        cerr << path << ": unsupported building format version " << header.version << endl;
+        return false;
+    }
+    if (size != sizeof(header) + (size_t)header.elevatorCount * sizeof(Elevator)) {
+        cerr << path << ": size does not match " << header.elevatorCount << " elevators" << endl;
+        return false;
+    }
+    const char* records = data + sizeof(header);
+    for (uint32_t i = 0; i < header.elevatorCount; i++) {
+        Elevator elevator;
+        memcpy(&elevator, records + (size_t)i * sizeof(Elevator), sizeof(Elevator));
+        if (memchr(elevator.bayId, '\0', idSize) == nullptr || elevator.bayId[0] == '\0' ||
+            elevator.lowestFloor > elevator.highestFloor || elevator.remainingCapacity < 0) {
+            cerr << path << ": elevator " << i << " is invalid" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool is_binary_building(const string& path) {
+    char magic[4] = {};
+    ifstream file(path, ios::binary);
+    return file.read(magic, sizeof(magic)) && memcmp(magic, binaryBuildingMagic, sizeof(magic)) == 0;
+}
+
+// map a compiled building file and copy its rows straight into the elevator table
+bool load_binary_building(const string& path, vector <Elevator>& elevators) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening file " << path << endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        cerr << "Error reading file " << path << endl;
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "Error mapping file " << path << endl;
+        return false;
+    }
+
+    const char* data = (const char*)mapped;
+    bool valid = validate_binary_building(data, size, path);
+    if (valid) {
+        BinaryBuildingHeader header;
+        memcpy(&header, data, sizeof(header));
+        elevators.resize(header.elevatorCount);
+        memcpy(elevators.data(), data + sizeof(header), (size_t)header.elevatorCount * sizeof(Elevator));
+    }
+    munmap(mapped, size);
+    return valid;
+}
+
+// convert a tab separated building file to the compiled format
+bool compile_building(const string& textPath, const string& binaryPath) {
+    vector <Elevator> elevators;
+    if (!load_text_building(textPath, elevators)) {
+        return false;
+    }
+    BinaryBuildingHeader header;
+    memcpy(header.magic, binaryBuildingMagic, sizeof(header.magic));
+    header.version = binaryBuildingVersion;
+    header.elevatorCount = (uint32_t)elevators.size();
+    header.recordSize = sizeof(Elevator);
+
+    // rows are zero filled first so the unused tail of every id field is deterministic on disk
+    vector <Elevator> rows(elevators.size());
+    memset(rows.data(), 0, rows.size() * sizeof(Elevator));
+    for (size_t i = 0; i < elevators.size(); i++) {
+        rows[i] = elevators[i];
+        size_t length = strlen(elevators[i].bayId);
+        memset(rows[i].bayId + length, 0, idSize - length);
+    }
+
+    ofstream file(binaryPath, ios::binary | ios::trunc);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)rows.data(), rows.size() * sizeof(Elevator));
+    if (!file) {
+        cerr << "Error writing file " << binaryPath << endl;
+        return false;
+    }
+    cout << "Compiled " << elevators.size() << " elevators into " << binaryPath << endl;
+    return true;
+}
+
+// load the elevator table of b from a text or compiled building file
+bool load_building(Building& b) {
+    auto startTime = chrono::steady_clock::now();
+    bool loaded = is_binary_building(b.buildingFile) ? load_binary_building(b.buildingFile, b.elevators)
+                                                      : load_text_building(b.buildingFile, b.elevators);
+    if (!loaded) {
+        return false;
+    }
+    for (size_t i = 0; i < b.elevators.size(); i++) {
+        b.elevatorIndex[b.elevators[i].bayId] = i;
+    }
+    // before any pipeline thread starts: the eligibility cache hands out pointers that a new generation
+    // would invalidate
+    b.generation++;
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime);
+
+    // only small tables are echoed, printing a large synthetic building would take longer than loading it
+    if (b.elevators.size() <= 50) {
+        for (const Elevator& elevator : b.elevators) {
+            cout << elevator.bayId << "\t" << elevator.lowestFloor << "\t" << elevator.highestFloor << "\t"
+                 << elevator.currentFloor << "\t" << elevator.remainingCapacity << "\t" << endl;
+        }
+    }
+    cout << "Loaded " << b.elevators.size() << " elevators from " << b.buildingFile
+         << " in " << elapsed.count() / 1000.0 << " ms" << endl;
+    return true;
+}
+
+// scheduler checkpoint (--checkpoint <file>): the people still waiting for a decision, the assignments not
+// put yet and the last known state of every car, as raw fixed size records behind a header. a background
+// thread copies the state into reused buffers under the locks, then writes and renames the file with no lock
+// held, so a crash mid-write leaves the previous checkpoint intact
+const char checkpointMagic[4] = {'E', 'L', 'V', 'S'};
+const uint32_t checkpointVersion = 2;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t elevatorCount;
+    uint32_t peopleCount;
+    uint32_t assignmentCount;
+    uint32_t recordSizes;  // sizeof(Elevator), sizeof(CheckpointPerson) and sizeof(Assignment), a byte each
+    uint64_t checksum;     // FNV-1a over everything after the header
+    int64_t writtenAt;     // seconds since the epoch
+};
+
+// the part of a Person that survives a restart. arrival times are steady clock readings of the old process
+struct CheckpointPerson {
+    char id[idSize];
+    int32_t startFloor;
+    int32_t endFloor;
+    int32_t priority;
+    int32_t retries;
+};
+
+static_assert(is_trivially_copyable<Assignment>::value, "Assignments are written to disk as raw bytes");
+static_assert(sizeof(Assignment) == 2 * idSize + 2 * sizeof(int32_t) + 2 * sizeof(long long),
+              "Assignments must not contain padding");
+
+uint32_t checkpoint_record_sizes() {
+    return (uint32_t)sizeof(Elevator) | (uint32_t)sizeof(CheckpointPerson) << 8 | (uint32_t)sizeof(Assignment) << 16;
+}
+
+uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// reused between checkpoints so a steady state capture does not allocate
+struct CheckpointBuffers {
+    vector <Elevator> elevators;
+    vector <CheckpointPerson> people;
+    vector <Assignment> assignments;
+};
+
+void capture_person(CheckpointBuffers& buffers, const Person& person) {
+    CheckpointPerson record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.id, person.id, strnlen(person.id, idSize - 1));
+    record.startFloor = person.startFloor;
+    record.endFloor = person.endFloor;
+    record.priority = person.priority;
+    record.retries = person.retries;
+    buffers.people.push_back(record);
+}
+
+// copy the scheduler state into buffers. b.mtx guards the shared queues and, in the threaded scheduler, the
+// elevator table, which every decision refreshes under it. zone schedulers refresh their cars' rows with no
+// lock held, so with --zones the cars are taken from each zone's checkpointCars under zone.mtx instead.
+// --checkpoint is refused with --assigners and --optimize-ms, so every assignment not put yet is on
+// assignedElevator
+void capture_checkpoint(Building& b, CheckpointBuffers& buffers) {
+    buffers.people.clear();
+    buffers.assignments.clear();
+    {
+        ProfiledLock lock(b.mtx, checkpointSite);
+        if (b.statusRefreshMs > 0) {
+            shared_ptr<const vector <Elevator>> snapshot = latest_snapshot(b);
+            buffers.elevators.assign(snapshot->begin(), snapshot->end());
+        } else if (b.zoned) {
+            // every car belongs to exactly one bank, so the zone loop below fills every row
+            buffers.elevators.resize(b.elevators.size());
+        } else {
+            buffers.elevators.assign(b.elevators.begin(), b.elevators.end());
+        }
+        for (size_t i = 0; i < b.people.size(); i++) {
+            capture_person(buffers, b.people[i]);
+        }
+        for (size_t i = 0; i < b.retryLane.size(); i++) {
+            capture_person(buffers, b.retryLane[i]);
+        }
+        for (size_t i = 0; i < b.assignedElevator.size(); i++) {
+            buffers.assignments.push_back(b.assignedElevator[i]);
+        }
+    }
+    for (Zone& zone : b.zones) {
+        lock_guard<mutex> zoneLock(zone.mtx);
+        for (size_t i = 0; i < zone.people.size(); i++) {
+            capture_person(buffers, zone.people[i]);
+        }
+        if (b.statusRefreshMs == 0) {
+            for (size_t n = 0; n < zone.cars.size(); n++) {
+                buffers.elevators[zone.cars[n]] = zone.checkpointCars[n];
+            }
+        }
+    }
+}
+
+bool write_checkpoint(const string& path, const CheckpointBuffers& buffers) {
+    CheckpointHeader header;
+    memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = checkpointVersion;
+    header.elevatorCount = (uint32_t)buffers.elevators.size();
+    header.peopleCount = (uint32_t)buffers.people.size();
+    header.assignmentCount = (uint32_t)buffers.assignments.size();
+    header.recordSizes = checkpoint_record_sizes();
+    header.checksum = fnv1a((const char*)buffers.elevators.data(), buffers.elevators.size() * sizeof(Elevator));
+    header.checksum = fnv1a((const char*)buffers.people.data(), buffers.people.size() * sizeof(CheckpointPerson),
+                            header.checksum);
+    header.checksum = fnv1a((const char*)buffers.assignments.data(), buffers.assignments.size() * sizeof(Assignment),
+                            header.checksum);
+    header.writtenAt = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+    string temporary = path + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)buffers.elevators.data(), buffers.elevators.size() * sizeof(Elevator));
+        file.write((const char*)buffers.people.data(), buffers.people.size() * sizeof(CheckpointPerson));
+        file.write((const char*)buffers.assignments.data(), buffers.assignments.size() * sizeof(Assignment));
+        if (!file) {
+            cerr << "Error writing checkpoint " << temporary << endl;
+            return false;
+        }
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        cerr << "Error replacing checkpoint " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+void checkpointer(Building& b){
+    CheckpointBuffers buffers;
+    while (!b.checkpointStop) {
+        for (int slept = 0; slept < b.checkpointMs && !b.checkpointStop; slept += 10) {
+            this_thread::sleep_for(chrono::milliseconds(min(10, b.checkpointMs - slept)));
+        }
+        if (b.checkpointStop) {
+            break;
+        }
+        long long start = now_ns();
+        capture_checkpoint(b, buffers);
+        long long captured = now_ns() - start;
+        b.checkpointCaptureNs += captured;
+        b.checkpointMaxCaptureNs = max(b.checkpointMaxCaptureNs, captured);
+        if (write_checkpoint(b.checkpointPath, buffers)) {
+            b.checkpointsWritten++;
+        }
+    }
+}
+
+// load the checkpoint of b, if there is one that matches its building: the car states replace the building
+// file values, the people go back into the waiting queue and the assignments onto assignedElevator, which the
+// assigner drains once it starts. returns false only when the file exists but cannot be used
+bool resume_from_checkpoint(Building& b) {
+    auto startTime = chrono::steady_clock::now();
+    ifstream file(b.checkpointPath, ios::binary);
+    if (!file) {
+        return true;
+    }
+    vector<char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    CheckpointHeader header;
+    if (data.size() < sizeof(header)) {
+        cerr << b.checkpointPath << ": too small for a checkpoint header" << endl;
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0 || header.version != checkpointVersion ||
+        header.recordSizes != checkpoint_record_sizes()) {
+        cerr << b.checkpointPath << ": not a checkpoint of this scheduler version" << endl;
+        return false;
+    }
+    size_t payload = (size_t)header.elevatorCount * sizeof(Elevator) +
+                     (size_t)header.peopleCount * sizeof(CheckpointPerson) +
+                     (size_t)header.assignmentCount * sizeof(Assignment);
+    if (data.size() != sizeof(header) + payload || fnv1a(data.data() + sizeof(header), payload) != header.checksum) {
+        cerr << b.checkpointPath << ": checkpoint is truncated or corrupt" << endl;
+        return false;
+    }
+    const char* records = data.data() + sizeof(header);
+    vector <Elevator> elevators(header.elevatorCount);
+    memcpy(elevators.data(), records, elevators.size() * sizeof(Elevator));
+    records += elevators.size() * sizeof(Elevator);
+    bool sameBuilding = elevators.size() == b.elevators.size();
+    for (size_t i = 0; sameBuilding && i < elevators.size(); i++) {
+        sameBuilding = memchr(elevators[i].bayId, '\0', idSize) != nullptr &&
+                       strcmp(elevators[i].bayId, b.elevators[i].bayId) == 0 &&
+                       elevators[i].lowestFloor == b.elevators[i].lowestFloor &&
+                       elevators[i].highestFloor == b.elevators[i].highestFloor;
+    }
+    if (!sameBuilding) {
+        cerr << b.checkpointPath << ": checkpoint is for a different building, starting fresh" << endl;
+        return true;
+    }
+    b.elevators.swap(elevators);
+    for (Zone& zone : b.zones) {
+        for (size_t n = 0; n < zone.cars.size(); n++) {
+            zone.checkpointCars[n] = b.elevators[zone.cars[n]];
+        }
+    }
+
+    for (uint32_t i = 0; i < header.peopleCount; i++) {
+        CheckpointPerson record;
+        memcpy(&record, records, sizeof(record));
+        records += sizeof(record);
+        Person person;
+        memset(&person, 0, sizeof(person));
+        memcpy(person.id, record.id, strnlen(record.id, idSize - 1));
+        person.startFloor = record.startFloor;
+        person.endFloor = record.endFloor;
+        person.priority = record.priority;
+        person.retries = record.retries;
+        person.arrivalNs = now_ns();
+        b.people.push_back(person);
+    }
+    for (uint32_t i = 0; i < header.assignmentCount; i++) {
+        Assignment assignment;
+        memcpy(&assignment, records, sizeof(assignment));
+        records += sizeof(assignment);
+        assignment.personId[idSize - 1] = '\0';
+        assignment.elevatorId[idSize - 1] = '\0';
+        assignment.readNs = assignment.assignedNs = now_ns();
+        reserve_car(b, assignment);
+        b.assignedElevator.push_back(assignment);
+    }
+    b.resumed = true;
+    long long age = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count() -
+                    header.writtenAt;
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime);
+    cout << "Resumed " << b.buildingFile << " from " << b.checkpointPath << " written " << age << " s ago: "
+         << header.peopleCount << " people waiting, " << header.assignmentCount << " assignments to put, "
+         << header.elevatorCount << " car states in " << elapsed.count() / 1000.0 << " ms" << endl;
+    return true;
+}
+
+void report_checkpoints(deque <Building>& buildings) {
+    cout << "Checkpoints:" << endl;
+    for (Building& b : buildings) {
+        cout << "  " << b.buildingFile << ": " << b.checkpointsWritten << " written to " << b.checkpointPath
+             << (b.resumed ? " after resuming" : "");
+        if (b.checkpointsWritten > 0) {
+            cout << ", capture took " << b.checkpointCaptureNs / 1000.0 / b.checkpointsWritten
+                 << " us on average and " << b.checkpointMaxCaptureNs / 1000.0 << " us at most, waiting for the locks included";
+        }
+        cout << endl;
+    }
+}
+
+// discrete-event simulator for offline policy evaluation (--simulate <hours>). the cars of the building file
+// travel, stop, cycle their doors and board passengers in virtual time, and every decision goes through the
+// same decide_elevator the live scheduler uses, which asks this simulator for car status through its
+// transport. nothing waits for a clock, so a day of traffic takes seconds
+const double simFloorSeconds = 1.5;  // travel between two adjacent floors
+const double simDoorSeconds = 4.0;   // open and close the doors once
+const double simBoardSeconds = 1.0;  // per passenger getting on or off
+
+struct SimPassenger {
+    int startFloor;
+    int endFloor;
+    double arrivedAt;
+    double boardedAt;
+    double deliveredAt;
+};
+
+struct SimCar {
+    int lowestFloor;
+    int highestFloor;
+    int capacity;
+    int floor;
+    int direction = 0;  // 1 up, -1 down, 0 idle
+    bool moving = false;
+    bool scheduled = false;  // the car has an event queued
+    vector <size_t> onboard;
+    vector <size_t> waiting;  // assigned, not boarded yet
+    long long stops = 0;
+    long long floorsTravelled = 0;
+};
+
+class EventSimulator {
+public:
+    explicit EventSimulator(const vector <Elevator>& elevators) {
+        for (size_t i = 0; i < elevators.size(); i++) {
+            SimCar car;
+            car.lowestFloor = elevators[i].lowestFloor;
+            car.highestFloor = elevators[i].highestFloor;
+            car.capacity = elevators[i].remainingCapacity;
+            car.floor = min(max(elevators[i].currentFloor, car.lowestFloor), car.highestFloor);
+            cars.push_back(car);
+            carIndex[elevators[i].bayId] = i;
+            bayIds.push_back(elevators[i].bayId);
+        }
+    }
+
+    // a passenger shows up at virtual time at; returns their index, which is their person id minus one
+    size_t arrive(int startFloor, int endFloor, double at) {
+        passengers.push_back(SimPassenger{startFloor, endFloor, at, -1, -1});
+        return passengers.size() - 1;
+    }
+
+    // process every car event up to virtual time until
+    void run_until(double until) {
+        while (!events.empty() && events.top().first <= until) {
+            now = events.top().first;
+            size_t car = events.top().second;
+            events.pop();
+            cars[car].scheduled = false;
+            step(car);
+        }
+        now = max(now, until);
+    }
+
+    // one "bayID|currentFloor|direction|passengerCount|remainingCapacity" line per car. promised seats count
+    // as taken, the way the live simulator counts a PUT
+    void status(const char* bayId, string& response) {
+        auto found = carIndex.find(key.assign(bayId));
+        if (found != carIndex.end()) {
+            append_status(found->second, response);
+        }
+    }
+
+    void status_all(string& response) {
+        for (size_t i = 0; i < cars.size(); i++) {
+            append_status(i, response);
+        }
+    }
+
+    void assign(const char* personId, const char* bayId) {
+        size_t passenger = (size_t)atoll(personId) - 1;
+        auto found = carIndex.find(key.assign(bayId));
+        if (passenger >= passengers.size() || found == carIndex.end()) {
+            return;
+        }
+        cars[found->second].waiting.push_back(passenger);
+        wake(found->second);
+    }
+
+    const vector <SimPassenger>& riders() const { return passengers; }
+    const vector <SimCar>& fleet() const { return cars; }
+
+private:
+    void append_status(size_t i, string& response) {
+        const SimCar& car = cars[i];
+        char line[128];
+        int taken = (int)(car.onboard.size() + car.waiting.size());
+        snprintf(line, sizeof(line), "%s|%d|%c|%d|%d\n", bayIds[i].c_str(), car.floor,
+                 car.direction > 0 ? 'U' : car.direction < 0 ? 'D' : 'S', (int)car.onboard.size(),
+                 max(0, car.capacity - taken));
+        response.append(line);
+    }
+
+    void wake(size_t car) {
+        if (!cars[car].scheduled) {
+            cars[car].scheduled = true;
+            events.push({now, car});
+        }
+    }
+
+    void later(size_t car, double seconds) {
+        cars[car].scheduled = true;
+        events.push({now + seconds, car});
+    }
+
+    // the car reached a floor or closed its doors: let people off and on, then keep going in the same
+    // direction while there is anything to do that way (collective control), otherwise turn or rest
+    void step(size_t i) {
+        SimCar& car = cars[i];
+        if (car.moving) {
+            car.floor += car.direction;
+            car.floorsTravelled++;
+            car.moving = false;
+        }
+        int movedPeople = 0;
+        for (size_t k = 0; k < car.onboard.size(); ) {
+            if (passengers[car.onboard[k]].endFloor == car.floor) {
+                passengers[car.onboard[k]].deliveredAt = now;
+                car.onboard[k] = car.onboard.back();
+                car.onboard.pop_back();
+                movedPeople++;
+            } else {
+                k++;
+            }
+        }
+        for (size_t k = 0; k < car.waiting.size() && (int)car.onboard.size() < car.capacity; ) {
+            if (passengers[car.waiting[k]].startFloor == car.floor) {
+                passengers[car.waiting[k]].boardedAt = now;
+                car.onboard.push_back(car.waiting[k]);
+                car.waiting.erase(car.waiting.begin() + k);
+                movedPeople++;
+            } else {
+                k++;
+            }
+        }
+        if (movedPeople > 0) {
+            car.stops++;
+            later(i, simDoorSeconds + simBoardSeconds * movedPeople);
+            return;
+        }
+        bool above = false;
+        bool below = false;
+        for (size_t passenger : car.onboard) {
+            above |= passengers[passenger].endFloor > car.floor;
+            below |= passengers[passenger].endFloor < car.floor;
+        }
+        for (size_t passenger : car.waiting) {
+            above |= passengers[passenger].startFloor > car.floor;
+            below |= passengers[passenger].startFloor < car.floor;
+        }
+        car.direction = (car.direction >= 0 && above) ? 1 : (car.direction <= 0 && below) ? -1
+                      : above ? 1 : below ? -1 : 0;
+        if (car.direction != 0) {
+            car.moving = true;
+            later(i, simFloorSeconds);
+        }
+    }
+
+    vector <SimCar> cars;
+    vector <string> bayIds;
+    unordered_map<string, size_t> carIndex;
+    string key;
+    vector <SimPassenger> passengers;
+    // (virtual time, car), earliest first. a car has at most one event queued
+    priority_queue<pair<double, size_t>, vector<pair<double, size_t>>, greater<pair<double, size_t>>> events;
+    double now = 0;
+};
+
+// the scheduler's transport while it runs against the discrete-event simulator
+class EventSimTransport : public Transport {
+public:
+    explicit EventSimTransport(EventSimulator& eventSimulator) : simulator(eventSimulator) {}
+
+    const string& get(const char* path, const char* first, const char*) override {
+        response.clear();
+        if (strcmp(path, "/ElevatorStatus/all") == 0) {
+            simulator.status_all(response);
+        } else if (strcmp(path, "/ElevatorStatus/bulk/") == 0) {
+            for (const char* id = first; *id != '\0'; ) {
+                const char* comma = strchr(id, ',');
+                simulator.status(bayId.assign(id, comma ? comma - id : strlen(id)).c_str(), response);
+                id = comma ? comma + 1 : id + strlen(id);
+            }
+        } else if (strcmp(path, "/ElevatorStatus/") == 0) {
+            simulator.status(first, response);
+            if (!response.empty()) {
+                response.pop_back();
+            }
+        } else {
+            response = "NONE";
+        }
+        return response;
+    }
+
+    void put(const char* path, const char* first, const char* second) override {
+        if (strcmp(path, "/AddPersonToElevator/") == 0 && second != nullptr) {
+            simulator.assign(first, second);
+        }
+    }
+
+private:
+    EventSimulator& simulator;
+    string response;
+    string bayId;
+};
+
+// what one simulated run produced: wait is arrival to boarding, ride is boarding to arrival, both in
+// virtual seconds, and the thread CPU time of every decision
+struct SimulationReport {
+    double hours = 0;
+    string traffic;
+    double wallSeconds = 0;
+    long long people = 0;
+    long long delivered = 0;
+    long long unassigned = 0;
+    long long retries = 0;
+    long long stranded = 0;
+    long long stops = 0;
+    long long floorsTravelled = 0;
+    vector <double> waits;
+    vector <double> rides;
+    vector <double> decisionNs;
+};
+
+long long thread_cpu_ns() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// the trip of the passenger arriving at virtual second at: inside the range of a random car, with most trips
+// starting at the lobby in the morning peak (7 to 10) and ending there in the evening peak (16 to 19)
+void simulated_trip(const Building& b, mt19937& generator, double at, int lobby, int& startFloor, int& endFloor) {
+    const Elevator& car = b.elevators[generator() % b.elevators.size()];
+    uniform_int_distribution<int> floor(car.lowestFloor, car.highestFloor);
+    uniform_real_distribution<double> chance(0, 1);
+    startFloor = floor(generator);
+    endFloor = floor(generator);
+    double hour = fmod(at / 3600, 24);
+    bool servesLobby = car.lowestFloor <= lobby && lobby <= car.highestFloor;
+    if (servesLobby && hour >= 7 && hour < 10 && chance(generator) < 0.8) {
+        startFloor = lobby;
+    } else if (servesLobby && hour >= 16 && hour < 19 && chance(generator) < 0.8) {
+        endFloor = lobby;
+    }
+}
+
+// a person no car has room for is decided again simRetrySeconds of virtual time later, at most simRetryTries
+// times (30 minutes) unless --retry-unsatisfiable sets the number of tries
+const double simRetrySeconds = 5;
+const int simRetryTries = 360;
+
+// one person of a simulated run, arriving at virtual second at
+struct SimArrival {
+    double at;
+    int startFloor;
+    int endFloor;
+    int priority;
+};
+
+// hours of Poisson arrivals at perMinute people a minute. the generator is seeded, so every run (and every
+// configuration of a sweep) sees the same people
+vector <SimArrival> synthetic_arrivals(const Building& b, double hours, double perMinute) {
+    vector <SimArrival> arrivals;
+    mt19937 generator{12345};
+    exponential_distribution<double> gap(perMinute / 60);
+    int lobby = INT_MAX;
+    for (const Elevator& car : b.elevators) {
+        lobby = min(lobby, car.lowestFloor);
+    }
+    for (double at = gap(generator); !b.elevators.empty() && at < hours * 3600; at += gap(generator)) {
+        SimArrival arrival{at, 0, 0, 0};
+        simulated_trip(b, generator, at, lobby, arrival.startFloor, arrival.endFloor);
+        if (arrival.startFloor != arrival.endFloor) {
+            arrivals.push_back(arrival);
+        }
+    }
+    return arrivals;
+}
+
+// a trace written by --record-trace. the person IDs are not kept, the simulator numbers the people itself
+bool load_trace(const string& path, vector <SimArrival>& arrivals) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "Cannot open trace " << path << endl;
+        return false;
+    }
+    string line;
+    while (getline(file, line)) {
+        SimArrival arrival{0, 0, 0, 0};
+        char id[idSize];
+        if (sscanf(line.c_str(), "%lf|%31[^|]|%d|%d|%d", &arrival.at, id, &arrival.startFloor, &arrival.endFloor,
+                   &arrival.priority) < 4) {
+            continue;
+        }
+        if (arrival.startFloor != arrival.endFloor) {
+            arrivals.push_back(arrival);
+        }
+    }
+    // the reader and the push listener append under one lock, but a person read while another waited for it
+    // may still be a few microseconds out of order
+    stable_sort(arrivals.begin(), arrivals.end(), [](const SimArrival& x, const SimArrival& y) { return x.at < y.at; });
+    return true;
+}
+
+// feed the arrivals to the scheduler in virtual time, deciding each person as they arrive, then let the cars
+// finish their rides
+SimulationReport run_simulation(Building& b, EventSimulator& simulator, const vector <SimArrival>& arrivals,
+                                const string& traffic) {
+    SimulationReport report;
+    report.hours = arrivals.empty() ? 0 : arrivals.back().at / 3600;
+    report.traffic = traffic;
+    auto wallStart = chrono::steady_clock::now();
+    int tries = b.maxRetries > 0 ? b.maxRetries : simRetryTries;
+    double lastDecision = 0;
+    size_t next = 0;
+    while (!b.elevators.empty() && (next < arrivals.size() || !b.retryLane.empty())) {
+        // the next event is whichever comes first: a new arrival or a person in the retry lane falling due.
+        // every retry waits the same simRetrySeconds, so the lane stays in due order
+        Person person{};
+        double at;
+        bool retryDue = !b.retryLane.empty() &&
+                        (next == arrivals.size() || b.retryLane.front().retryAtNs <= arrivals[next].at * 1e9);
+        if (retryDue) {
+            person = b.retryLane.front();
+            b.retryLane.pop_front();
+            at = person.retryAtNs / 1e9;
+            simulator.run_until(at);
+        } else {
+            const SimArrival& arrival = arrivals[next++];
+            at = arrival.at;
+            simulator.run_until(at);
+            person.startFloor = arrival.startFloor;
+            person.endFloor = arrival.endFloor;
+            person.priority = arrival.priority;
+            size_t passenger = simulator.arrive(person.startFloor, person.endFloor, at);
+            snprintf(person.id, idSize, "%zu", passenger + 1);
+            person.arrivalNs = (long long)(at * 1e9);
+            observe_traffic(b, person);
+        }
+        lastDecision = at;
+
+        long long cpuStart = thread_cpu_ns();
+        Assignment assignment = decide_elevator(b, person);
+        report.decisionNs.push_back((double)(thread_cpu_ns() - cpuStart));
+        if (assignment.elevatorId[0] == '\0' && person.retries < tries) {
+            // no car has room right now: the person keeps waiting at their floor and is decided again later
+            person.retries++;
+            person.retryAtNs = (long long)((at + simRetrySeconds) * 1e9);
+            b.retryLane.push_back(person);
+            b.retriedPeople++;
+            report.retries++;
+            continue;
+        }
+        if (assignment.elevatorId[0] == '\0') {
+            report.unassigned++;
+            b.gaveUpPeople++;
+        }
+        b.transport->put("/AddPersonToElevator/", assignment.personId, assignment.elevatorId);
+        car_put(b, assignment);
+    }
+    simulator.run_until(numeric_limits<double>::infinity());
+
+    // a person no car ever took has waited from their arrival to the end of the run, which is counted as their
+    // wait (censored) so that dropping people never makes a policy look faster
+    double endAt = lastDecision;
+    for (const SimPassenger& passenger : simulator.riders()) {
+        endAt = max(endAt, passenger.deliveredAt);
+    }
+    for (const SimPassenger& passenger : simulator.riders()) {
+        report.people++;
+        if (passenger.deliveredAt >= 0) {
+            report.delivered++;
+            report.waits.push_back(passenger.boardedAt - passenger.arrivedAt);
+            report.rides.push_back(passenger.deliveredAt - passenger.boardedAt);
+        } else {
+            report.stranded++;
+            report.waits.push_back(endAt - passenger.arrivedAt);
+        }
+    }
+    for (const SimCar& car : simulator.fleet()) {
+        report.stops += car.stops;
+        report.floorsTravelled += car.floorsTravelled;
+    }
+    report.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+    return report;
+}
+
+// mean, p50/p90/p99 and max of values, which are sorted in place
+void print_distribution(const char* label, vector <double>& values, double scale, const char* unit) {
+    cout << "    " << label << ":";
+    if (values.empty()) {
+        cout << " none" << endl;
+        return;
+    }
+    sort(values.begin(), values.end());
+    double sum = 0;
+    for (double value : values) {
+        sum += value;
+    }
+    cout << " mean " << sum / values.size() * scale << " " << unit;
+    const double percentiles[] = {0.5, 0.9, 0.99};
+    for (double percentile : percentiles) {
+        cout << ", p" << percentile * 100 << " " << values[(size_t)(percentile * (values.size() - 1))] * scale << " " << unit;
+    }
+    cout << ", max " << values.back() * scale << " " << unit << endl;
+}
+
+void report_simulation(const string& buildingFile, SimulationReport& report) {
+    cout << "Simulated " << report.hours << " h of " << report.traffic << " on " << buildingFile << " in "
+         << report.wallSeconds << " s (" << (long long)(report.hours * 3600 / max(report.wallSeconds, 1e-9))
+         << "x real time)" << endl
+         << "  " << report.people << " people: " << report.delivered << " delivered, " << report.retries
+         << " decisions retried for want of room, " << report.unassigned << " assigned no car after the last try, "
+         << report.stranded << " not delivered" << endl;
+    print_distribution("wait for the car (not delivered: to the end of the run)", report.waits, 1, "s");
+    print_distribution("ride", report.rides, 1, "s");
+    print_distribution("decision CPU time", report.decisionNs, 1e-3, "us");
+    cout << "    cars: " << report.stops << " stops, " << report.floorsTravelled << " floors travelled" << endl;
+}
+
+// one point of a --sweep grid
+struct SweepConfig {
+    Policy policy = Policy::fill;
+    size_t trafficWindow = 0;
+    bool zoned = false;
+    bool cacheEligibility = true;
+    string label;
+};
+
+// --sweep "policy=fill,nearest;traffic-window=0,100;zones=0,1;eligibility-cache=0,1": the grid is the cartesian
+// product of the listed values, a parameter left out keeps its command line value
+bool parse_sweep(const string& spec, const SweepConfig& base, vector <SweepConfig>& configs) {
+    configs.assign(1, base);
+    stringstream clauses(spec);
+    string clause;
+    while (getline(clauses, clause, ';')) {
+        size_t equals = clause.find('=');
+        string name = clause.substr(0, equals);
+        if (equals == string::npos) {
+            cerr << "--sweep expects <parameter>=<value>,<value>;... not " << clause << endl;
+            return false;
+        }
+        vector <SweepConfig> grid;
+        stringstream values(clause.substr(equals + 1));
+        string value;
+        while (getline(values, value, ',')) {
+            for (SweepConfig config : configs) {
+                if (name == "policy" && (value == "fill" || value == "nearest" || value == "balance")) {
+                    config.policy = value == "fill" ? Policy::fill : value == "nearest" ? Policy::nearest : Policy::balance;
+                } else if (name == "traffic-window") {
+                    config.trafficWindow = (size_t)max(0, atoi(value.c_str()));
+                } else if (name == "zones" && (value == "0" || value == "1")) {
+                    config.zoned = value == "1";
+                } else if (name == "eligibility-cache" && (value == "0" || value == "1")) {
+                    config.cacheEligibility = value == "1";
+                } else {
+                    cerr << "Unknown --sweep value " << name << "=" << value
+                         << " (policy=fill|nearest|balance, traffic-window=<people>, zones=0|1, eligibility-cache=0|1)" << endl;
+                    return false;
+                }
+                grid.push_back(config);
+            }
+        }
+        configs.swap(grid);
+    }
+    for (SweepConfig& config : configs) {
+        config.label = string("policy=") + policy_name(config.policy) + " traffic-window=" +
+                       to_string(config.trafficWindow) + " zones=" + (config.zoned ? "1" : "0") +
+                       " eligibility-cache=" + (config.cacheEligibility ? "1" : "0");
+    }
+    return !configs.empty();
+}
+
+// run every configuration against the same arrivals, each on its own copy of the building with its own
+// simulator, spread over a worker per core. the results come back in the order of configs
+vector <SimulationReport> run_sweep(const Building& base, const vector <SweepConfig>& configs,
+                                    const vector <SimArrival>& arrivals, const string& traffic) {
+    deque <Building> copies;
+    vector <unique_ptr<EventSimulator>> simulators;
+    vector <SimulationReport> reports(configs.size());
+    for (const SweepConfig& config : configs) {
+        copies.emplace_back();
+        Building& b = copies.back();
+        b.buildingFile = base.buildingFile;
+        b.elevators = base.elevators;
+        b.elevatorIndex = base.elevatorIndex;
+        b.generation++;
+        b.policy = config.policy;
+        b.cacheEligibility = config.cacheEligibility;
+        b.maxRetries = base.maxRetries;
+        b.zoned = config.zoned;
+        if (b.zoned) {
+            build_zones(b);
+        }
+        if (config.trafficWindow > 0) {
+            init_traffic(b, config.trafficWindow);
+        }
+        simulators.emplace_back(new EventSimulator(b.elevators));
+        b.transport.reset(new EventSimTransport(*simulators.back()));
+        probe_bulk_status(b);
+        publish_snapshot(b, b.elevators);
+    }
+    WorkStealingPool pool(max(1u, thread::hardware_concurrency()));
+    for (size_t i = 0; i < configs.size(); i++) {
+        pool.submit([&, i] { reports[i] = run_simulation(copies[i], *simulators[i], arrivals, traffic); });
+    }
+    pool.wait_until_idle();
+    return reports;
+}
+
+// the sweep ranked by the share of people delivered, then by mean wait, best first. the wait of a person who
+// was never delivered runs to the end of the run, so a configuration cannot rank higher by dropping people
+void report_sweep(const string& buildingFile, const vector <SweepConfig>& configs, vector <SimulationReport>& reports,
+                  double wallSeconds) {
+    vector <size_t> order(configs.size());
+    vector <double> meanWaits(configs.size(), numeric_limits<double>::infinity());
+    vector <double> deliveredShares(configs.size(), 0);
+    for (size_t i = 0; i < configs.size(); i++) {
+        order[i] = i;
+        sort(reports[i].waits.begin(), reports[i].waits.end());
+        if (!reports[i].waits.empty()) {
+            meanWaits[i] = accumulate(reports[i].waits.begin(), reports[i].waits.end(), 0.0) / reports[i].waits.size();
+        }
+        if (reports[i].people > 0) {
+            deliveredShares[i] = (double)reports[i].delivered / reports[i].people;
+        }
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return deliveredShares[x] != deliveredShares[y] ? deliveredShares[x] > deliveredShares[y]
+                                                        : meanWaits[x] < meanWaits[y];
+    });
+
+    cout << "Sweep of " << configs.size() << " configurations over " << (reports.empty() ? 0 : reports[0].hours)
+         << " h of " << (reports.empty() ? "" : reports[0].traffic) << " on " << buildingFile << " in "
+         << wallSeconds << " s" << endl
+         << "  waits of people not delivered run to the end of the run" << endl;
+    char line[320];
+    snprintf(line, sizeof(line), "  %4s  %-62s %10s %13s %10s %9s %9s %9s %9s %15s", "rank", "configuration",
+             "delivered", "not delivered", "unassigned", "mean wait", "p90 wait", "p99 wait", "mean ride",
+             "decisions/cpu-s");
+    cout << line << endl;
+    for (size_t rank = 0; rank < order.size(); rank++) {
+        SimulationReport& report = reports[order[rank]];
+        const vector <double>& waits = report.waits;
+        double ride = report.rides.empty() ? 0 : accumulate(report.rides.begin(), report.rides.end(), 0.0) / report.rides.size();
+        double decisionNs = accumulate(report.decisionNs.begin(), report.decisionNs.end(), 0.0);
+        snprintf(line, sizeof(line), "  %4zu  %-62s %9.2f%% %13lld %10lld %8.1fs %8.1fs %8.1fs %8.1fs %15.0f", rank + 1,
+                 configs[order[rank]].label.c_str(), 100 * deliveredShares[order[rank]], report.stranded,
+                 report.unassigned, waits.empty() ? 0 : meanWaits[order[rank]],
+                 waits.empty() ? 0 : waits[(size_t)(0.9 * (waits.size() - 1))],
+                 waits.empty() ? 0 : waits[(size_t)(0.99 * (waits.size() - 1))], ride,
+                 decisionNs > 0 ? report.decisionNs.size() / (decisionNs / 1e9) : 0);
+        cout << line << endl;
+    }
+}
+
+// heap allocations per person once the pipeline was warm. the threaded pipeline should report 0
+void report_allocations(deque <Building>& buildings) {
+    cout << "Heap allocations: " << allocationCount.load() << " total" << endl;
+    for (Building& b : buildings) {
+        long long people = b.peopleRead.load();
+        long long warm = b.warmAllocations.load();
+        cout << "  " << b.buildingFile << ": " << people << " people";
+        if (warm >= 0 && people > 10) {
+            cout << ", " << (double)(allocationCount.load() - warm) / (people - 10)
+                 << " allocations per person after warm-up";
+        }
+        cout << endl;
+    }
+}
+
+// --http-deadline-ms: one deadline for every endpoint, or a list such as check=500,input=200,status=50,put=200
+bool parse_http_deadlines(const string& spec) {
+    if (spec.find('=') == string::npos) {
+        fill(begin(httpPolicy.deadlineMs), end(httpPolicy.deadlineMs), max(0L, atol(spec.c_str())));
+        return true;
+    }
+    stringstream list(spec);
+    string item;
+    while (getline(list, item, ',')) {
+        size_t equals = item.find('=');
+        int endpoint = 0;
+        while (endpoint < endpointCount && (equals == string::npos || item.compare(0, equals, endpointNames[endpoint]) != 0)) {
+            endpoint++;
+        }
+        if (endpoint == endpointCount) {
+            cerr << "Unknown endpoint in --http-deadline-ms: " << item << endl;
+            return false;
+        }
+        httpPolicy.deadlineMs[endpoint] = max(0L, atol(item.c_str() + equals + 1));
+    }
+    return true;
+}
+
+// --pin-cores: the core each pipeline stage runs on. every thread of a stage (--zones, --assigners) shares it
+enum PipelineStage { readerStage, schedulerStage, assignerStage, refresherStage, stageCount };
+
+bool parse_pin_cores(const string& spec, int (&cores)[stageCount]) {
+    stringstream list(spec);
+    string item;
+    int stage = 0;
+    while (getline(list, item, ',')) {
+        if (stage == stageCount) {
+            cerr << "--pin-cores takes at most " << stageCount << " cores." << endl;
+            return false;
+        }
+        cores[stage++] = atoi(item.c_str());
+    }
+    return true;
+}
+
+void pin_thread(thread& t, int core) {
+    if (core < 0) {
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    int error = pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+    if (error != 0) {
+        cerr << "Cannot pin a thread to core " << core << ": " << strerror(error) << endl;
+    }
+}
+
+// how the pipeline stages were woken: while spinning or after parking, and how long from the notify until
+// the woken stage ran
+void report_wakeups(deque <Building>& buildings) {
+    cout << "Stage wakeups (spin window " << spinNs / 1000 << " us):" << endl;
+    auto report = [](const Handoff& handoff, const string& name) {
+        long long spun = handoff.spinWakeups.load();
+        long long count = spun + handoff.parkedWakeups.load();
+        if (count == 0) {
+            return;
+        }
+        cout << "    " << name << ": " << count << " wakeups, " << spun << " while spinning";
+        const double percentiles[] = {0.5, 0.99};
+        for (double percentile : percentiles) {
+            long long seen = 0;
+            int bucket = 0;
+            while (bucket < 63 && (seen += handoff.latencyBuckets[bucket].load()) < percentile * count) {
+                bucket++;
+            }
+            cout << ", p" << percentile * 100 << " <= " << (1LL << bucket) << " ns";
+        }
+        cout << ", max " << handoff.maxLatencyNs.load() << " ns notify to run" << endl;
+    };
+    for (Building& b : buildings) {
+        cout << "  " << b.buildingFile << ":" << endl;
+        report(b.cv_scheduler, b.cv_scheduler.name);
+        for (const Zone& zone : b.zones) {
+            report(zone.cv, string(zone.cv.name) + " " + to_string(zone.lowestFloor) + "-" + to_string(zone.highestFloor));
+        }
+        report(b.cv_optimizer, b.cv_optimizer.name);
+        report(b.cv_addToElevator, b.cv_addToElevator.name);
+    }
+}
+
+// per endpoint latency, timeouts, retries and hedges of the HTTP calls
+void report_http() {
+    cout << "HTTP calls:" << endl;
+    for (int endpoint = 0; endpoint < endpointCount; endpoint++) {
+        HttpEndpointStats& stats = httpPolicy.stats[endpoint];
+        if (stats.calls == 0) {
+            continue;
+        }
+        cout << "  " << endpointNames[endpoint] << ": " << stats.calls << " calls";
+        long long count = 0;
+        for (const auto& bucket : stats.buckets) {
+            count += bucket.load();
+        }
+        const double percentiles[] = {0.5, 0.99};
+        for (double percentile : percentiles) {
+            if (count == 0) {
+                break;
+            }
+            long long seen = 0;
+            int bucket = 0;
+            while (bucket < 63 && (seen += stats.buckets[bucket].load()) < percentile * count) {
+                bucket++;
+            }
+            cout << ", p" << percentile * 100 << " <= " << (1LL << bucket) << " us";
+        }
+        cout << ", deadline " << httpPolicy.deadlineMs[endpoint] << " ms, " << stats.timeouts << " timeouts, "
+             << stats.retries << " retries, " << stats.hedgesFired << " hedges fired, " << stats.hedgesWon
+             << " won, " << stats.failures << " failed" << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Check if at least one command-line argument (besides the program name) is provided
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <input_building_file>[@<simulator_url>] ... [options]" << endl
+             << "       " << argv[0] << " --compile-building <input_building_file> <output_binary_file>" << endl
+             << "Options: --pool --event-loop --prefetch <k> --listen <port>|unix:<path>" << endl
+             << "         --in-process <people> --quiet --no-bulk-status" << endl
+             << "         --status-refresh-ms <ms> --speculate --late-binding <floors> --zones" << endl
+             << "         --reserve <max-age-ms> --traffic-window <people>" << endl
+             << "         --optimize-ms <ms> --no-eligibility-cache --eligibility-stats" << endl
+             << "         --priority-aging-ms <ms> --retry-unsatisfiable <tries> --wait-stats" << endl
+             << "         --http-deadline-ms <ms>|<endpoint>=<ms>,... --hedge-percentile <p> --http-retries <n>" << endl
+             << "         --assigners <n> --pin-cores <reader>,<scheduler>,<assigner>[,<refresher>]" << endl
+             << "         --spin-us <us> --wakeup-stats --checkpoint <file> --checkpoint-ms <ms>" << endl
+             << "         --simulate <hours> --sim-rate <people/min> --replay <trace> --record-trace <file> --kpi" << endl
+             << "         --sweep \"policy=fill,nearest,balance;traffic-window=0,100;zones=0,1;eligibility-cache=0,1\"" << endl
+             << "         --profile-locks --alloc-stats" << endl;
+        return 1; // Return error code 1 indicating incorrect usage
+    }
+
+    if (string(argv[1]) == "--compile-building") {
+        if (argc != 4) {
+            cerr << "Usage: " << argv[0] << " --compile-building <input_building_file> <output_binary_file>" << endl;
+            return 1;
+        }
+        return compile_building(argv[2], argv[3]) ? 0 : 1;
+    }
+
+    // every argument that is not an option is a building, optionally followed by @ and its simulator url.
+    // a deque keeps every Building at a fixed address, the pool tasks hold references to them
+    deque <Building> buildings;
+    bool eventLoop = false;
+    bool pool = false;
+    int prefetchDepth = 1;
+    string listenAddress;
+    long long inProcessPeople = 0;
+    bool quiet = false;
+    bool bulkStatus = true;
+    int statusRefreshMs = 0;
+    bool speculative = false;
+    int lateBindingMargin = -1;
+    bool zoned = false;
+    int reserveMaxAgeMs = -1;
+    size_t trafficWindow = 0;
+    int optimizeMs = 0;
+    bool cacheEligibility = true;
+    bool eligibilityStats = false;
+    int agingMs = 0;
+    int maxRetries = 0;
+    bool waitStats = false;
+    bool httpStats = false;
+    int assigners = 1;
+    int stageCores[stageCount] = {-1, -1, -1, -1};
+    bool pinned = false;
+    string checkpointPath;
+    int checkpointMs = 1000;
+    double simulateHours = 0;
+    double simulateRate = 10;
+    string tracePath;
+    string replayPath;
+    string sweepSpec;
+    bool kpi = false;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--profile-locks") {
+            profileLocks = true;
+        } else if (option == "--event-loop") {
+            eventLoop = true;
+        } else if (option == "--pool") {
+            pool = true;
+        } else if (option == "--alloc-stats") {
+#ifndef ALLOC_STATS
+            cerr << "--alloc-stats needs a build with the allocation counter, cmake -DALLOC_STATS=ON." << endl;
+            return 1;
+#endif
+            allocationStats = true;
+        } else if (option == "--in-process" && i + 1 < argc) {
+            inProcessPeople = atoll(argv[++i]);
+        } else if (option == "--quiet") {
+            quiet = true;
+        } else if (option == "--status-refresh-ms" && i + 1 < argc) {
+            statusRefreshMs = max(1, atoi(argv[++i]));
+        } else if (option == "--late-binding" && i + 1 < argc) {
+            lateBindingMargin = max(0, atoi(argv[++i]));
+        } else if (option == "--reserve" && i + 1 < argc) {
+            reserveMaxAgeMs = max(0, atoi(argv[++i]));
+        } else if (option == "--traffic-window" && i + 1 < argc) {
+            trafficWindow = (size_t)max(0, atoi(argv[++i]));
+        } else if (option == "--optimize-ms" && i + 1 < argc) {
+            optimizeMs = max(1, atoi(argv[++i]));
+        } else if (option == "--no-eligibility-cache") {
+            cacheEligibility = false;
+        } else if (option == "--eligibility-stats") {
+            eligibilityStats = true;
+        } else if (option == "--priority-aging-ms" && i + 1 < argc) {
+            agingMs = max(1, atoi(argv[++i]));
+        } else if (option == "--retry-unsatisfiable" && i + 1 < argc) {
+            maxRetries = max(0, atoi(argv[++i]));
+        } else if (option == "--wait-stats") {
+            waitStats = true;
+        } else if (option == "--http-deadline-ms" && i + 1 < argc) {
+            if (!parse_http_deadlines(argv[++i])) {
+                return 1;
+            }
+            httpStats = true;
+        } else if (option == "--hedge-percentile" && i + 1 < argc) {
+            httpPolicy.hedgePercentile = min(99.9, max(1.0, atof(argv[++i])));
+            httpStats = true;
+        } else if (option == "--http-retries" && i + 1 < argc) {
+            httpPolicy.retries = max(0, atoi(argv[++i]));
+            httpStats = true;
+        } else if (option == "--simulate" && i + 1 < argc) {
+            simulateHours = max(0.0, atof(argv[++i]));
+        } else if (option == "--sim-rate" && i + 1 < argc) {
+            simulateRate = max(0.01, atof(argv[++i]));
+        } else if (option == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (option == "--sweep" && i + 1 < argc) {
+            sweepSpec = argv[++i];
+        } else if (option == "--record-trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (option == "--kpi") {
+            kpi = true;
+        } else if (option == "--checkpoint" && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (option == "--checkpoint-ms" && i + 1 < argc) {
+            checkpointMs = max(1, atoi(argv[++i]));
+        } else if (option == "--pin-cores" && i + 1 < argc) {
+            if (!parse_pin_cores(argv[++i], stageCores)) {
+                return 1;
+            }
+            pinned = true;
+        } else if (option == "--spin-us" && i + 1 < argc) {
+            spinNs = max(0LL, atoll(argv[++i])) * 1000;
+        } else if (option == "--wakeup-stats") {
+            wakeupStats = true;
+        } else if (option == "--assigners" && i + 1 < argc) {
+            assigners = max(1, atoi(argv[++i]));
+        } else if (option == "--zones") {
+            zoned = true;
+        } else if (option == "--speculate") {
+            speculative = true;
+        } else if (option == "--no-bulk-status") {
+            bulkStatus = false;
+        } else if (option == "--listen" && i + 1 < argc) {
+            listenAddress = argv[++i];
+        } else if (option == "--prefetch" && i + 1 < argc) {
+            prefetchDepth = max(1, atoi(argv[++i]));
+        } else if (option.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option: " << option << endl;
+            return 1;
+        } else {
+            buildings.emplace_back();
+            size_t at = option.find('@');
+            buildings.back().buildingFile = option.substr(0, at);
+            if (at != string::npos) {
+                buildings.back().simulatorUrl = option.substr(at + 1);
+            }
+        }
+    }
+    if (buildings.empty()) {
+        cerr << "No input building file given." << endl;
+        return 1;
+    }
+    if (eventLoop && buildings.size() > 1) {
+        cerr << "--event-loop runs a single building." << endl;
+        return 1;
+    }
+    if (eventLoop && pool) {
+        cerr << "--event-loop and --pool are separate modes, pick one." << endl;
+        return 1;
+    }
+    if ((speculative || lateBindingMargin >= 0 || optimizeMs > 0) && statusRefreshMs == 0) {
+        cerr << "--speculate, --late-binding and --optimize-ms work from the refresher's snapshots and need --status-refresh-ms." << endl;
+        return 1;
+    }
+    if (reserveMaxAgeMs >= 0 && eventLoop) {
+        cerr << "--reserve works with the threaded and pool modes." << endl;
+        return 1;
+    }
+    if (eventLoop && (speculative || lateBindingMargin >= 0 || maxRetries > 0)) {
+        cerr << "--event-loop decides and puts each person in its callbacks and cannot use --speculate, --late-binding" << endl
+             << "or --retry-unsatisfiable." << endl;
+        return 1;
+    }
+    if (inProcessPeople > 0 && (eventLoop || prefetchDepth > 1)) {
+        cerr << "--event-loop and --prefetch drive libcurl directly and cannot use --in-process." << endl;
+        return 1;
+    }
+    if ((!listenAddress.empty() || optimizeMs > 0) && (eventLoop || pool || buildings.size() > 1)) {
+        cerr << "--listen and --optimize-ms work with the threaded single building mode." << endl;
+        return 1;
+    }
+    bool simulate = simulateHours > 0 || !replayPath.empty();
+    if (maxRetries > 0 && !simulate && (zoned || pool || buildings.size() > 1)) {
+        cerr << "--retry-unsatisfiable works with the threaded scheduler without --zones, and with --simulate." << endl;
+        return 1;
+    }
+    if (simulate && (statusRefreshMs > 0 || inProcessPeople > 0 || eventLoop || pool || prefetchDepth > 1 ||
+                     !listenAddress.empty() || assigners > 1 || pinned || !checkpointPath.empty() || !tracePath.empty() ||
+                     kpi || reserveMaxAgeMs >= 0)) {
+        cerr << "--simulate and --replay decide every person themselves in virtual time. They cannot be combined with" << endl
+             << "--status-refresh-ms, --in-process, --event-loop, --pool, --prefetch, --listen, --assigners, --pin-cores," << endl
+             << "--checkpoint, --record-trace, --kpi or --reserve." << endl;
+        return 1;
+    }
+    if (!sweepSpec.empty() && (!simulate || buildings.size() > 1)) {
+        cerr << "--sweep runs a single building under --simulate or --replay." << endl;
+        return 1;
+    }
+    vector <SweepConfig> sweepConfigs;
+    SweepConfig baseConfig;
+    baseConfig.trafficWindow = trafficWindow;
+    baseConfig.zoned = zoned;
+    baseConfig.cacheEligibility = cacheEligibility;
+    if (!sweepSpec.empty() && !parse_sweep(sweepSpec, baseConfig, sweepConfigs)) {
+        return 1;
+    }
+    vector <SimArrival> replayed;
+    if (!replayPath.empty() && !load_trace(replayPath, replayed)) {
+        return 1;
+    }
+    if ((assigners > 1 || pinned || !checkpointPath.empty()) && (eventLoop || pool || buildings.size() > 1)) {
+        cerr << "--assigners, --pin-cores and --checkpoint work with the threaded single building mode." << endl;
+        return 1;
+    }
+    if (!checkpointPath.empty() && (assigners > 1 || optimizeMs > 0)) {
+        cerr << "--checkpoint cannot see the --assigners worker queues or the window --optimize-ms is working on." << endl;
+        return 1;
+    }
+
+    vector <unique_ptr<SimulatedBackend>> backends;
+    vector <unique_ptr<EventSimulator>> simulators;
+    for (Building& b : buildings) {
+        b.prefetchDepth = prefetchDepth;
+        b.statusRefreshMs = statusRefreshMs;
+        b.speculate = speculative;
+        b.lateBindingMargin = lateBindingMargin;
+        b.zoned = zoned;
+        b.optimizeMs = optimizeMs;
+        b.cacheEligibility = cacheEligibility;
+        b.people.set_aging(agingMs * 1000000LL);
+        b.maxRetries = maxRetries;
+        // a single assigner keeps the original assignedElevator thread
+        for (int i = 0; assigners > 1 && i < assigners; i++) {
+            b.assignerShards.emplace_back();
+        }
+        b.waitStats = waitStats || agingMs > 0 || maxRetries > 0;
+        if (!load_building(b)) {
+            return 1;
+        }
+        if (b.zoned) {
+            build_zones(b);
+            for (Zone& zone : b.zones) {
+                zone.people.set_aging(agingMs * 1000000LL);
+            }
+        }
+        if (trafficWindow > 0) {
+            init_traffic(b, trafficWindow);
+        }
+        if (reserveMaxAgeMs >= 0) {
+            b.ledger.reset(new ReservationLedger(b.elevators.size()));
+            b.reserveMaxAgeMs = reserveMaxAgeMs;
+        }
+        b.checkpointPath = checkpointPath;
+        b.checkpointMs = checkpointMs;
+        if (!checkpointPath.empty() && !resume_from_checkpoint(b)) {
+            return 1;
+        }
+        if (kpi) {
+            init_kpi(b);
+        }
+        if (!tracePath.empty()) {
+            b.trace.reset(new ofstream(tracePath));
+            b.traceStartNs = now_ns();
+            if (!*b.trace) {
+                cerr << "Cannot write trace " << tracePath << endl;
+                return 1;
+            }
+        }
+        if (simulate) {
+            simulators.emplace_back(new EventSimulator(b.elevators));
+            b.transport.reset(new EventSimTransport(*simulators.back()));
+        } else if (inProcessPeople > 0) {
+            backends.emplace_back(new SimulatedBackend(b.elevators, inProcessPeople));
+            b.transport.reset(new InProcessTransport(*backends.back()));
+        } else {
+            b.transport.reset(new HttpTransport(b.simulatorUrl));
+        }
+    }
+
+    // --quiet silences the per person console output, which would otherwise dominate a benchmark run
+    streambuf* console = cout.rdbuf();
+    // a sweep runs every configuration at once, their output would only interleave
+    if (quiet || !sweepSpec.empty()) {
+        cout.rdbuf(nullptr);
+    }
+    auto startTime = chrono::steady_clock::now();
+
+    for (Building& b : buildings) {
+        if (bulkStatus) {
+            probe_bulk_status(b);
+        }
+        // the first snapshot holds the building file values, so the scheduler always has a table to read
+        publish_snapshot(b, b.elevators);
+    }
+    vector <SimulationReport> simulations;
+    if (simulate) {
+        ostringstream traffic;
+        if (replayPath.empty()) {
+            traffic << "traffic at " << simulateRate << " people/min";
+        } else {
+            traffic << "replayed trace " << replayPath << " (" << replayed.size() << " people)";
+        }
+        for (size_t i = 0; i < buildings.size(); i++) {
+            vector <SimArrival> generated;
+            if (replayPath.empty()) {
+                generated = synthetic_arrivals(buildings[i], simulateHours, simulateRate);
+            }
+            const vector <SimArrival>& arrivals = replayPath.empty() ? generated : replayed;
+            if (sweepConfigs.empty()) {
+                simulations.push_back(run_simulation(buildings[i], *simulators[i], arrivals, traffic.str()));
+            } else {
+                simulations = run_sweep(buildings[i], sweepConfigs, arrivals, traffic.str());
+            }
+        }
+    } else if (pool || buildings.size() > 1) {
+        run_pool(buildings);
+    } else {
+        Building& b = buildings.front();
+        // a resumed scheduler joins the simulation that is already running
+        if (!b.resumed) {
+            b.transport->put("/Simulation/start");
+        }
+        if (eventLoop) {
+            run_event_loop(b);
+        } else {
+            thread listen;
+            if (!listenAddress.empty()) {
+                int listenFd = open_listener(listenAddress);
+                if (listenFd < 0) {
+                    return 1;
+                }
+                b.inputSources++;
+                listen = thread(listener, ref(b), listenFd);
+            }
+            thread refresher;
+            if (b.statusRefreshMs > 0) {
+                refresher = thread(status_refresher, ref(b));
+                pin_thread(refresher, stageCores[refresherStage]);
+            }
+            thread optimizer;
+            if (b.optimizeMs > 0) {
+                optimizer = thread(anytime_optimizer, ref(b));
+            }
+            thread checkpoints;
+            if (!b.checkpointPath.empty()) {
+                checkpoints = thread(checkpointer, ref(b));
+            }
+            thread read(reader, ref(b));
+            vector <thread> schedulers;
+            if (b.zoned) {
+                b.zoneThreads = (int)b.zones.size() + 1;
+                schedulers.emplace_back(route_people, ref(b));
+                for (Zone& zone : b.zones) {
+                    schedulers.emplace_back(schedule_zone, ref(b), ref(zone));
+                }
+            } else {
+                schedulers.emplace_back(schedule_elevator, ref(b));
+            }
+            vector <thread> assignerThreads;
+            if (b.assignerShards.empty()) {
+                assignerThreads.emplace_back(add_person_to_elevator, ref(b));
+            }
+            for (AssignerShard& shard : b.assignerShards) {
+                assignerThreads.emplace_back(assigner_worker, ref(b), ref(shard));
+            }
+            pin_thread(read, stageCores[readerStage]);
+            for (thread& schedule : schedulers) {
+                pin_thread(schedule, stageCores[schedulerStage]);
+            }
+            for (thread& assign : assignerThreads) {
+                pin_thread(assign, stageCores[assignerStage]);
+            }
+
+            read.join();
+            if (listen.joinable()) {
+                listen.join();
+            }
+            for (thread& schedule : schedulers) {
+                schedule.join();
+            }
+            for (thread& assign : assignerThreads) {
+                assign.join();
+            }
+            if (optimizer.joinable()) {
+                optimizer.join();
+            }
+            if (checkpoints.joinable()) {
+                b.checkpointStop = true;
+                checkpoints.join();
+                // everyone was put: a restart now would resume a finished simulation
+                remove(b.checkpointPath.c_str());
+            }
+            if (refresher.joinable()) {
+                b.refresherStop = true;
+                refresher.join();
+            }
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout.clear();
+    cout.rdbuf(console);
+
+    if (!sweepConfigs.empty()) {
+        report_sweep(buildings.front().buildingFile, sweepConfigs, simulations, seconds);
+    } else {
+        for (size_t i = 0; i < simulations.size(); i++) {
+            report_simulation(buildings[i].buildingFile, simulations[i]);
+        }
+    }
+    if (inProcessPeople > 0) {
+        long long assigned = 0;
+        long long overfilled = 0;
+        for (auto& backend : backends) {
+            assigned += backend->assignedPeople();
+            overfilled += backend->overfilledPeople();
+        }
+        cout << "In-process run: " << assigned << " people assigned in " << seconds * 1000 << " ms ("
+             << (long long)(assigned / seconds) << " people/s), " << overfilled << " put into a full car" << endl;
+    }
+    if (profileLocks) {
+        report_lock_profile();
+    }
+    if (allocationStats) {
+        report_allocations(buildings);
+    }
+    if (speculative) {
+        report_speculation(buildings);
+    }
+    if (lateBindingMargin >= 0) {
+        report_late_binding(buildings);
+    }
+    if (zoned) {
+        report_zones(buildings);
+    }
+    if (reserveMaxAgeMs >= 0) {
+        report_reservations(buildings);
+    }
+    if (trafficWindow > 0) {
+        report_traffic(buildings);
+    }
+    if (optimizeMs > 0) {
+        report_optimizer(buildings);
+    }
+    if (eligibilityStats) {
+        report_eligibility(buildings);
+    }
+    if (waitStats || agingMs > 0 || maxRetries > 0) {
+        report_waiting(buildings);
+    }
+    if (kpi) {
+        report_kpi(buildings);
+    }
+    if (httpStats) {
+        report_http();
+    }
+    if (assigners > 1) {
+        report_assigners(buildings);
+    }
+    if (wakeupStats) {
+        report_wakeups(buildings);
+    }
+    if (!checkpointPath.empty()) {
+        report_checkpoints(buildings);
+    }
 
     return 0;
 }